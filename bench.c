@@ -0,0 +1,358 @@
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "block_ops.h"
+#include "disk_image.h"
+#include "indirect_walk.h"
+#include "inode_scan.h"
+#include "libdefrag.h"
+#include "util.h"
+
+/* Micro-benchmarks behind `make bench`. Each figure is the best of
+   BENCH_REPEATS runs so one-off scheduling noise does not show up. */
+
+#define BENCH_REPEATS 5
+#define KERNEL_BYTES  (64u << 20) /* data pushed through each kernel per run */
+/* Remap tables of a small image (cache-resident) and a large one (cache-missing) */
+#define REMAP_SMALL   (1 << 14)
+#define REMAP_LARGE   (1 << 20)
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+typedef struct {
+    unsigned char *src;       /* pointer entries below REMAP_LARGE */
+    unsigned char *src_small; /* pointer entries below REMAP_SMALL */
+    unsigned char *dst;
+    int *table;      /* old->new table, as build_remap_table makes */
+    int table_size;
+    int blocks;
+} KernelBench;
+
+static double time_remap(const BlockOps *ops, const KernelBench *kb) {
+    double best = 1e30;
+    for (int r = 0; r < BENCH_REPEATS; ++r) {
+        double t0 = now_sec();
+        for (int i = 0; i < kb->blocks; ++i) {
+            ops->remap_pointers(kb->dst + block_ops_offset(ops, i), kb->src + block_ops_offset(ops, i),
+                                (size_t)ops->blocksize, kb->table, kb->table_size);
+        }
+        double t = now_sec() - t0;
+        if (t < best) best = t;
+    }
+    return best;
+}
+
+static double time_remap_small(const BlockOps *ops, const KernelBench *kb) {
+    KernelBench small = *kb;
+    small.src = kb->src_small;
+    small.table_size = REMAP_SMALL;
+    return time_remap(ops, &small);
+}
+
+/* Generic against specialized remap kernels for every specialized blocksize
+   (copy and fill have no specialized variants) */
+static int bench_kernels(void) {
+    static const int sizes[] = { 512, 1024, 2048, 4096 };
+    static const char *names[] = { "remap (16K tbl)", "remap (1M tbl)" };
+    double (*timers[])(const BlockOps *, const KernelBench *) = { time_remap_small, time_remap };
+
+    KernelBench kb;
+    kb.src = (unsigned char *)malloc(KERNEL_BYTES);
+    kb.src_small = (unsigned char *)malloc(KERNEL_BYTES);
+    kb.dst = (unsigned char *)malloc(KERNEL_BYTES);
+    kb.table = (int *)malloc(sizeof(int) * REMAP_LARGE);
+    kb.table_size = REMAP_LARGE;
+    if (!kb.src || !kb.src_small || !kb.dst || !kb.table) {
+        free(kb.src);
+        free(kb.src_small);
+        free(kb.dst);
+        free(kb.table);
+        return -1;
+    }
+    /* Pointer blocks: random (fragmented) block indices, the tail of each block unused (-1) */
+    unsigned int seed = 12345;
+    for (int i = 0; i < REMAP_LARGE; ++i) kb.table[i] = REMAP_LARGE - 1 - i;
+    for (size_t i = 0; i < KERNEL_BYTES / 4; ++i) {
+        seed = seed * 1103515245u + 12345u;
+        int used = (i % 128) < 100;
+        write_int_le(kb.src + i * 4, used ? (int)((seed >> 8) % REMAP_LARGE) : -1);
+        write_int_le(kb.src_small + i * 4, used ? (int)((seed >> 8) % REMAP_SMALL) : -1);
+    }
+    memset(kb.dst, 0, KERNEL_BYTES);
+
+    printf("Pointer remap kernels, %u MiB per run, best of %d (MB/s)\n", KERNEL_BYTES >> 20, BENCH_REPEATS);
+    printf("  %-6s %-16s %10s %12s %8s\n", "bs", "kernel", "generic", "specialized", "speedup");
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        BlockOps gen, spec;
+        block_ops_generic(&gen, sizes[s]);
+        block_ops_select(&spec, sizes[s]);
+        kb.blocks = (int)(KERNEL_BYTES / (unsigned int)sizes[s]);
+        for (int k = 0; k < 2; ++k) {
+            double tg = timers[k](&gen, &kb);
+            double ts = timers[k](&spec, &kb);
+            double mb = (double)KERNEL_BYTES / 1e6;
+            printf("  %-6d %-16s %10.0f %12.0f %7.2fx\n", sizes[s], names[k], mb / tg, mb / ts, tg / ts);
+        }
+    }
+    free(kb.src);
+    free(kb.src_small);
+    free(kb.dst);
+    free(kb.table);
+    return 0;
+}
+
+/* Indirect-tree walks over one image: the breadth-first batched walker
+   (indirect_walk.c) against a depth-first walk that reads one pointer
+   block at a time. The fd walkers run from a cold page cache and a hot
+   one; the in-memory walkers (what build_block_mapping uses) from cold
+   CPU caches and hot ones. */
+
+#define EVICT_BYTES (64u << 20) /* written to push the image out of the CPU caches */
+
+typedef struct {
+    int fd;
+    struct superblock sb;
+    BlockOps ops;
+    int total_blocks;
+    long long data_base;         /* file offset of data block 0 */
+    unsigned char *image;        /* whole image in memory */
+    size_t image_size;
+    const unsigned char *mem;    /* data region for the in-memory walkers, NULL for fd */
+    unsigned char *inodes;
+    int ninodes;
+    unsigned char *block;        /* depth-first fd walker: one pointer block per level */
+    unsigned char *evict;
+} WalkBench;
+
+/* Evict the image from the page cache so the next run reads from storage */
+static void drop_page_cache(WalkBench *w) {
+    fdatasync(w->fd);
+    posix_fadvise(w->fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+static void drop_cpu_caches(WalkBench *w) {
+    for (size_t i = 0; i < EVICT_BYTES; i += 64) w->evict[i]++;
+}
+
+/* Pointer block blk, read for the given tree level in fd mode */
+static const unsigned char *pointer_block(WalkBench *w, int blk, int level) {
+    if (blk < 0 || blk >= w->total_blocks) return NULL;
+    if (w->mem) return w->mem + block_ops_offset(&w->ops, blk);
+    unsigned char *buf = w->block + block_ops_offset(&w->ops, level - 1);
+    size_t bs = (size_t)w->sb.blocksize;
+    off_t off = (off_t)(w->data_base + (long long)block_ops_offset(&w->ops, blk));
+    return pread(w->fd, buf, bs, off) == (ssize_t)bs ? buf : NULL;
+}
+
+static long long depth_first_tree(WalkBench *w, int blk, int level, long long *left) {
+    if (level == 0) {
+        (*left)--;
+        return 1;
+    }
+    const unsigned char *p = pointer_block(w, blk, level);
+    if (!p) return -1;
+    long long n = 0;
+    for (int k = 0; k < w->sb.blocksize / 4 && *left > 0; ++k) {
+        int v = safe_read_int_le(p + (size_t)k * 4);
+        if (v == -1) break;
+        long long c = depth_first_tree(w, v, level - 1, left);
+        if (c < 0) return -1;
+        n += c;
+    }
+    return n;
+}
+
+static long long inode_blocks(const WalkBench *w, const struct inode *in) {
+    if (in->nlink <= 0) return 0;
+    return ((long long)in->size + w->sb.blocksize - 1) / w->sb.blocksize;
+}
+
+/* Data blocks reached under every used inode's indirect pointers */
+static long long walk_depth_first(WalkBench *w) {
+    long long found = 0;
+    for (int i = 0; i < w->ninodes; ++i) {
+        const struct inode *in = (const struct inode *)(w->inodes + (size_t)i * sizeof(struct inode));
+        long long left = inode_blocks(w, in) - N_DBLOCKS;
+        for (int j = 0; j < N_IBLOCKS && left > 0 && in->iblocks[j] != -1; ++j) {
+            long long c = depth_first_tree(w, in->iblocks[j], 1, &left);
+            if (c < 0) return -1;
+            found += c;
+        }
+        int roots[2] = { in->i2block, in->i3block };
+        for (int l = 0; l < 2 && left > 0; ++l) {
+            if (roots[l] == -1) continue;
+            long long c = depth_first_tree(w, roots[l], l + 2, &left);
+            if (c < 0) return -1;
+            found += c;
+        }
+    }
+    return found;
+}
+
+static long long walk_breadth_first(WalkBench *w) {
+    BlockSource src;
+    if (w->mem) {
+        block_source_memory(&src, w->mem, &w->ops, w->total_blocks, NULL);
+    } else if (block_source_fd(&src, w->fd, w->data_base, &w->ops, w->total_blocks, NULL) != 0) {
+        return -1;
+    }
+    long long found = 0;
+    for (int i = 0; i < w->ninodes && found >= 0; ++i) {
+        const struct inode *in = (const struct inode *)(w->inodes + (size_t)i * sizeof(struct inode));
+        long long left = inode_blocks(w, in) - N_DBLOCKS;
+        int nsingles = 0;
+        while (nsingles < N_IBLOCKS && in->iblocks[nsingles] != -1) nsingles++;
+        const int *roots[3] = { in->iblocks, &in->i2block, &in->i3block };
+        int nroots[3] = { nsingles, in->i2block != -1, in->i3block != -1 };
+        for (int l = 0; l < 3 && left > 0; ++l) {
+            if (nroots[l] == 0) continue;
+            IndirectTree tree;
+            if (indirect_tree_resolve(&src, roots[l], nroots[l], l + 1, (int)left, &tree) != 0) {
+                indirect_tree_free(&tree, NULL);
+                found = -1;
+                break;
+            }
+            found += tree.count[l + 1];
+            left -= tree.count[l + 1];
+            indirect_tree_free(&tree, NULL);
+        }
+    }
+    block_source_close(&src);
+    return found;
+}
+
+static long long fd_depth_first(WalkBench *w) {
+    w->mem = NULL;
+    return walk_depth_first(w);
+}
+
+static long long fd_breadth_first(WalkBench *w) {
+    w->mem = NULL;
+    return walk_breadth_first(w);
+}
+
+static long long mem_depth_first(WalkBench *w) {
+    w->mem = w->image + w->data_base;
+    return walk_depth_first(w);
+}
+
+static long long mem_breadth_first(WalkBench *w) {
+    w->mem = w->image + w->data_base;
+    return walk_breadth_first(w);
+}
+
+/* The planner on the in-memory image (build_block_mapping walks with the memory source) */
+static long long plan_in_memory(WalkBench *w) {
+    DefragContext *ctx = defrag_create(NULL);
+    long long rc = -1;
+    if (ctx && defrag_load(ctx, w->image, w->image_size) == DEFRAG_OK && defrag_plan(ctx) == DEFRAG_OK) {
+        DefragInfo info;
+        if (defrag_info(ctx, &info) == DEFRAG_OK) rc = info.map_size;
+    }
+    defrag_destroy(ctx);
+    return rc;
+}
+
+typedef struct {
+    const char *name;
+    long long (*walk)(WalkBench *);
+    void (*make_cold)(WalkBench *);
+    int same_blocks; /* must reach the same data blocks as the other walkers */
+} Walker;
+
+static double time_walk(WalkBench *w, const Walker *wk, int cold, long long *result) {
+    double best = 1e30;
+    for (int r = 0; r < BENCH_REPEATS; ++r) {
+        if (cold) wk->make_cold(w);
+        double t0 = now_sec();
+        *result = wk->walk(w);
+        double t = now_sec() - t0;
+        if (*result < 0) return -1;
+        if (t < best) best = t;
+    }
+    return best;
+}
+
+static int bench_walk(const char *path) {
+    static const Walker walkers[] = {
+        { "fd depth-first pread", fd_depth_first, drop_page_cache, 1 },
+        { "fd breadth-first", fd_breadth_first, drop_page_cache, 1 },
+        { "mem depth-first", mem_depth_first, drop_cpu_caches, 1 },
+        { "mem breadth-first", mem_breadth_first, drop_cpu_caches, 1 },
+        { "defrag_plan (mem)", plan_in_memory, drop_cpu_caches, 0 },
+    };
+    WalkBench w;
+    memset(&w, 0, sizeof(w));
+    unsigned char head[1024];
+    w.fd = open(path, O_RDONLY);
+    if (w.fd < 0 || pread(w.fd, head, sizeof(head), 0) != (ssize_t)sizeof(head) ||
+        parse_superblock(head, &w.sb) != 0) {
+        if (w.fd >= 0) close(w.fd);
+        return -1;
+    }
+    block_ops_select(&w.ops, w.sb.blocksize);
+    size_t bs = (size_t)w.sb.blocksize;
+    size_t inode_bytes = (size_t)(w.sb.data_offset - w.sb.inode_offset) * bs;
+    w.total_blocks = w.sb.swap_offset - w.sb.data_offset;
+    w.data_base = 1024 + (long long)w.sb.data_offset * (long long)bs;
+    w.image_size = (size_t)lseek(w.fd, 0, SEEK_END);
+    w.ninodes = (int)(inode_bytes / sizeof(struct inode));
+    w.image = (unsigned char *)malloc(w.image_size);
+    w.block = (unsigned char *)malloc(bs * 3);
+    w.evict = (unsigned char *)calloc(EVICT_BYTES, 1);
+    int rc = -1;
+    if (!w.image || !w.block || !w.evict ||
+        pread(w.fd, w.image, w.image_size, 0) != (ssize_t)w.image_size ||
+        (size_t)w.data_base + block_ops_offset(&w.ops, w.total_blocks) > w.image_size) {
+        goto out;
+    }
+    w.inodes = w.image + 1024 + (size_t)w.sb.inode_offset * bs;
+
+    printf("Indirect walk of %s (%zu MB, %d-byte blocks), best of %d (ms)\n", path, w.image_size >> 20,
+           w.sb.blocksize, BENCH_REPEATS);
+    printf("  %-22s %10s %10s %12s\n", "walker", "cold", "hot", "blocks");
+    long long expect = -1;
+    for (size_t k = 0; k < sizeof(walkers) / sizeof(walkers[0]); ++k) {
+        long long cold_n, hot_n;
+        double cold = time_walk(&w, &walkers[k], 1, &cold_n);
+        double hot = time_walk(&w, &walkers[k], 0, &hot_n);
+        if (cold < 0 || hot < 0 || cold_n != hot_n) goto out;
+        if (walkers[k].same_blocks) {
+            if (expect >= 0 && cold_n != expect) goto out;
+            expect = cold_n;
+        }
+        printf("  %-22s %10.2f %10.2f %12lld\n", walkers[k].name, cold * 1e3, hot * 1e3, cold_n);
+    }
+    rc = 0;
+out:
+    free(w.evict);
+    free(w.block);
+    free(w.image);
+    close(w.fd);
+    return rc;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s kernels | walk <image>\n", argv[0]);
+        return 1;
+    }
+    if (strcmp(argv[1], "kernels") == 0) {
+        if (bench_kernels() != 0) fatal("Kernel benchmark failed");
+        return 0;
+    }
+    if (strcmp(argv[1], "walk") == 0 && argc == 3) {
+        if (bench_walk(argv[2]) != 0) fatal("Walk benchmark failed on '%s'", argv[2]);
+        return 0;
+    }
+    fprintf(stderr, "Unknown benchmark '%s'\n", argv[1]);
+    return 1;
+}
@@ -0,0 +1,10 @@
+#ifndef BLOCK_HASH_H
+#define BLOCK_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* XXH64 (seed 0) of one block; fast enough to run inside the copy loop */
+uint64_t block_hash(const unsigned char *p, size_t len);
+
+#endif /* BLOCK_HASH_H */
@@ -0,0 +1,85 @@
+#include "block_ops.h"
+#include "util.h"
+#include <string.h>
+
+/* Generic kernels: runtime blocksize, need not be a multiple of 4 */
+
+static void copy_block_generic(unsigned char *dst, const unsigned char *src, size_t blocksize) {
+    memcpy(dst, src, blocksize);
+}
+
+/* Entries outside the table (including -1) and unmapped blocks stay as they are */
+static inline int remap_entry(int val, const int *new_of_old, int table_size) {
+    if (val < 0 || val >= table_size) return val;
+    int mapped = new_of_old[val];
+    return mapped != -1 ? mapped : val;
+}
+
+static void remap_pointers_generic(unsigned char *dst, const unsigned char *src, size_t blocksize,
+                                   const int *new_of_old, int table_size) {
+    size_t ptrs = blocksize / 4;
+    for (size_t i = 0; i < ptrs; ++i) {
+        write_int_le(dst + i * 4, remap_entry(safe_read_int_le(src + i * 4), new_of_old, table_size));
+    }
+    /* Zero remainder beyond pointer array */
+    memset(dst + ptrs * 4, 0, blocksize - ptrs * 4);
+}
+
+static void fill_free_block_generic(unsigned char *dst, int next, size_t blocksize) {
+    write_int_le(dst, next);
+    memset(dst + 4, 0, blocksize - 4);
+}
+
+/* Specialized remap kernels: BS is a compile-time constant, so the pointer
+   loop is unrolled four entries at a time. Copy and fill stay generic:
+   fixed-size memcpy/memset variants measured slower than libc's. */
+#define DEFINE_REMAP_KERNEL(BS)                                                              \
+    static void remap_pointers_##BS(unsigned char *dst, const unsigned char *src, size_t bs, \
+                                    const int *new_of_old, int table_size) {                 \
+        (void)bs;                                                                            \
+        for (size_t i = 0; i < (BS) / 4; i += 4) {                                           \
+            int v0 = safe_read_int_le(src + i * 4 + 0);                                      \
+            int v1 = safe_read_int_le(src + i * 4 + 4);                                      \
+            int v2 = safe_read_int_le(src + i * 4 + 8);                                      \
+            int v3 = safe_read_int_le(src + i * 4 + 12);                                     \
+            write_int_le(dst + i * 4 + 0, remap_entry(v0, new_of_old, table_size));          \
+            write_int_le(dst + i * 4 + 4, remap_entry(v1, new_of_old, table_size));          \
+            write_int_le(dst + i * 4 + 8, remap_entry(v2, new_of_old, table_size));          \
+            write_int_le(dst + i * 4 + 12, remap_entry(v3, new_of_old, table_size));         \
+        }                                                                                    \
+    }
+
+DEFINE_REMAP_KERNEL(512)
+DEFINE_REMAP_KERNEL(1024)
+DEFINE_REMAP_KERNEL(2048)
+DEFINE_REMAP_KERNEL(4096)
+
+#define BLOCK_OPS_ENTRY(BS, SHIFT) \
+    { BS, SHIFT, #BS, copy_block_generic, remap_pointers_##BS, fill_free_block_generic }
+
+static const BlockOps specialized_ops[] = {
+    BLOCK_OPS_ENTRY(512, 9),
+    BLOCK_OPS_ENTRY(1024, 10),
+    BLOCK_OPS_ENTRY(2048, 11),
+    BLOCK_OPS_ENTRY(4096, 12),
+};
+
+static const BlockOps generic_ops = {
+    0, -1, "generic", copy_block_generic, remap_pointers_generic, fill_free_block_generic
+};
+
+void block_ops_select(BlockOps *ops, int blocksize) {
+    for (size_t i = 0; i < sizeof(specialized_ops) / sizeof(specialized_ops[0]); ++i) {
+        if (specialized_ops[i].blocksize == blocksize) {
+            *ops = specialized_ops[i];
+            return;
+        }
+    }
+    block_ops_generic(ops, blocksize);
+}
+
+void block_ops_generic(BlockOps *ops, int blocksize) {
+    /* Copied per caller so contexts with different odd blocksizes don't share state */
+    *ops = generic_ops;
+    ops->blocksize = blocksize;
+}
@@ -0,0 +1,35 @@
+#ifndef BLOCK_OPS_H
+#define BLOCK_OPS_H
+
+#include <stddef.h>
+
+/* Maps an old data-region block index to its new index, -1 if unmapped */
+typedef int (*block_remap_fn)(const void *map_ctx, int old_index);
+
+/* Per-blocksize kernels used by the copy, remap and free-list passes.
+   Power-of-two sizes get shift-based offsets and a pointer-remap loop
+   unrolled for a compile-time block size; everything else is generic. */
+typedef struct {
+	int blocksize;
+	int shift; /* log2(blocksize) for specialized variants, -1 for generic */
+	const char *name;
+	void (*copy_block)(unsigned char *dst, const unsigned char *src, size_t blocksize);
+	/* new_of_old[old] is the new index of each data block (-1 unmapped); the
+		table is indexed directly so the unrolled loops need no calls */
+	void (*remap_pointers)(unsigned char *dst, const unsigned char *src, size_t blocksize,
+						   const int *new_of_old, int table_size);
+	void (*fill_free_block)(unsigned char *dst, int next, size_t blocksize);
+} BlockOps;
+
+/* Fill ops with the kernels for a blocksize; call once after parse_superblock */
+void block_ops_select(BlockOps *ops, int blocksize);
+/* The generic kernels regardless of blocksize (benchmarks compare against them) */
+void block_ops_generic(BlockOps *ops, int blocksize);
+
+/* Byte offset of block idx relative to the start of a region */
+static inline size_t block_ops_offset(const BlockOps *ops, int idx) {
+	if (ops->shift >= 0) return (size_t)idx << ops->shift;
+	return (size_t)idx * (size_t)ops->blocksize;
+}
+
+#endif /* BLOCK_OPS_H */
@@ -1,144 +1,168 @@
 #include "block_rewrite.h"
 #include "inode_scan.h"
 #include "util.h"
+#include "defrag_alloc.h"
+#include "block_hash.h"
+#include "indirect_walk.h"
 #include <stdlib.h>
 #include <string.h>
 
-static void map_add(BlockMapEntry **map, int *size, int old_idx, int new_idx, int is_pointer) {
-    BlockMapEntry *m = *map;
-    int n = *size;
-    m = (BlockMapEntry *)realloc(m, sizeof(BlockMapEntry) * (size_t)(n + 1));
-    if (!m) fatal("realloc failed for block map");
-    m[n].old_index = old_idx;
-    m[n].new_index = new_idx;
-    m[n].is_pointer = is_pointer;
-    *map = m;
-    *size = n + 1;
+static int map_add(RewriteContext *ctx, int old_idx, int new_idx, int is_pointer) {
+    int n = ctx->map_size;
+    if (n == ctx->map_cap) {
+        int cap = ctx->map_cap > 0 ? ctx->map_cap * 2 : 1024;
+        BlockMapEntry *m = (BlockMapEntry *)defrag_mem_realloc(ctx->alloc, ctx->map,
+                                                               sizeof(BlockMapEntry) * (size_t)cap);
+        if (!m) return -1;
+        ctx->map = m;
+        ctx->map_cap = cap;
+    }
+    ctx->map[n].old_index = old_idx;
+    ctx->map[n].new_index = new_idx;
+    ctx->map[n].is_pointer = is_pointer;
+    ctx->map_size = n + 1;
+    return 0;
 }
 
 static int map_lookup(const RewriteContext *ctx, int old_idx) {
+    if (ctx->new_of_old) {
+        int total = ctx->sb->swap_offset - ctx->sb->data_offset;
+        return old_idx >= 0 && old_idx < total ? ctx->new_of_old[old_idx] : -1;
+    }
     for (int i = 0; i < ctx->map_size; ++i) {
         if (ctx->map[i].old_index == old_idx) return ctx->map[i].new_index;
     }
     return -1;
 }
 
+static int ctx_remap(const void *map_ctx, int old_idx) {
+    return map_lookup((const RewriteContext *)map_ctx, old_idx);
+}
+
+/* Map one resolved pointer block (nodes[level][k]) and, depth-first, the
+   blocks below it: each pointer block precedes the blocks it points to. */
+static int emit_subtree(RewriteContext *ctx, const IndirectTree *t, int level, int k,
+                        int *cursor, int *remaining) {
+    if (map_add(ctx, t->nodes[level][k], (*cursor)++, 1) != 0) return -1;
+    for (int c = t->first[level][k]; c < t->first[level][k + 1] && *remaining > 0; ++c) {
+        if (level + 1 == t->levels) {
+            if (map_add(ctx, t->nodes[level + 1][c], (*cursor)++, 0) != 0) return -1;
+            (*remaining)--;
+        } else if (emit_subtree(ctx, t, level + 1, c, cursor, remaining) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Resolve the trees under roots breadth-first (prefetching each level
+   before descending), then lay them out depth-first */
+static int map_indirect(RewriteContext *ctx, BlockSource *src, const int *roots, int nroots,
+                        int levels, int *cursor, int *remaining) {
+    IndirectTree tree;
+    if (indirect_tree_resolve(src, roots, nroots, levels, *remaining, &tree) != 0) {
+        indirect_tree_free(&tree, ctx->alloc);
+        return -1;
+    }
+    int rc = 0;
+    for (int k = 0; k < tree.count[0] && *remaining > 0 && rc == 0; ++k) {
+        rc = emit_subtree(ctx, &tree, 0, k, cursor, remaining);
+    }
+    indirect_tree_free(&tree, ctx->alloc);
+    return rc;
+}
+
 int build_block_mapping(RewriteContext *ctx) {
-    if (!ctx || !ctx->sb || !ctx->records || !ctx->placements) return -1;
+    if (!ctx || !ctx->sb || !ctx->ops || !ctx->records || !ctx->placements) return -1;
     ctx->map = NULL;
     ctx->map_size = 0;
+    ctx->map_cap = 0;
 
-    int ptrs_per_block = ctx->sb->blocksize / 4;
+    size_t base = 512 + 512 + (size_t)ctx->sb->data_offset * (size_t)ctx->sb->blocksize;
+    BlockSource src;
+    block_source_memory(&src, ctx->in_buf + base, ctx->ops,
+                        ctx->sb->swap_offset - ctx->sb->data_offset, ctx->alloc);
 
     for (int i = 0; i < ctx->count; ++i) {
         const FileRecord *fr = &ctx->records[i];
         const FilePlacement *pl = &ctx->placements[i];
-          int cursor = pl->start_block;
+        int cursor = pl->start_block;
 
         /* Map direct data blocks */
         for (int j = 0; j < fr->direct_count; ++j) {
-            int old = fr->direct_blocks[j];
-            int newi = cursor;
-            map_add(&ctx->map, &ctx->map_size, old, newi, 0);
+            if (map_add(ctx, fr->direct_blocks[j], cursor, 0) != 0) return -1;
             cursor++;
         }
 
         int remaining = fr->data_block_count - fr->direct_count;
-        int data_offset = fr->direct_count;
-        /* After direct blocks, place single-indirect pointer blocks followed by their data */
-
-        /* Consume single-indirect blocks available in iblocks array before using double/triple */
+        /* After direct blocks, place single-indirect pointer blocks followed by their data;
+           consume the iblocks array before using double/triple */
         if (remaining > 0) {
-            size_t base = 512 + 512 + (size_t)ctx->sb->data_offset * (size_t)ctx->sb->blocksize;
-            for (int ib = 0; ib < N_IBLOCKS && remaining > 0; ++ib) {
-                int single_block_old = fr->raw->iblocks[ib];
-                if (single_block_old == -1) break;
-                int single_block_new = cursor;
-                map_add(&ctx->map, &ctx->map_size, single_block_old, single_block_new, 1);
-                cursor++;
-                size_t single_abs = base + (size_t)single_block_old * (size_t)ctx->sb->blocksize;
-                const unsigned char *p = ctx->in_buf + single_abs;
-                for (int k = 0; k < ptrs_per_block && remaining > 0; ++k) {
-                    int old_data_idx = safe_read_int_le(p + (size_t)k * 4);
-                    if (old_data_idx == -1) break;
-                    int new_data_idx = cursor;
-                    map_add(&ctx->map, &ctx->map_size, old_data_idx, new_data_idx, 0);
-                    cursor++;
-                    remaining--;
-                }
+            int singles[N_IBLOCKS];
+            int nsingles = 0;
+            while (nsingles < N_IBLOCKS && fr->raw->iblocks[nsingles] != -1) {
+                singles[nsingles] = fr->raw->iblocks[nsingles];
+                nsingles++;
             }
+            if (map_indirect(ctx, &src, singles, nsingles, 1, &cursor, &remaining) != 0) return -1;
         }
 
         /* Double indirect enumeration */
         if (remaining > 0 && fr->raw->i2block != -1) {
-            int dind_old = fr->raw->i2block;
-            int dind_new = cursor;
-            map_add(&ctx->map, &ctx->map_size, dind_old, dind_new, 1);
-            cursor++;
-            size_t base = 512 + 512 + (size_t)ctx->sb->data_offset * (size_t)ctx->sb->blocksize;
-            size_t dind_abs = base + (size_t)dind_old * (size_t)ctx->sb->blocksize;
-            const unsigned char *dp = ctx->in_buf + dind_abs;
-            for (int k = 0; k < ptrs_per_block && remaining > 0; ++k) {
-                int single_block_old = safe_read_int_le(dp + (size_t)k * 4);
-                if (single_block_old == -1) break;
-                int single_block_new = cursor;
-                map_add(&ctx->map, &ctx->map_size, single_block_old, single_block_new, 1);
-                cursor++;
-                size_t single_abs = base + (size_t)single_block_old * (size_t)ctx->sb->blocksize;
-                const unsigned char *sp = ctx->in_buf + single_abs;
-                for (int s = 0; s < ptrs_per_block && remaining > 0; ++s) {
-                    int old_data_idx = safe_read_int_le(sp + (size_t)s * 4);
-                    if (old_data_idx == -1) break;
-                    int new_data_idx = cursor;
-                    map_add(&ctx->map, &ctx->map_size, old_data_idx, new_data_idx, 0);
-                    cursor++;
-                    remaining--;
-                }
-            }
+            if (map_indirect(ctx, &src, &fr->raw->i2block, 1, 2, &cursor, &remaining) != 0) return -1;
         }
 
         /* Triple indirect enumeration */
         if (remaining > 0 && fr->raw->i3block != -1) {
-            int tind_old = fr->raw->i3block;
-            int tind_new = cursor;
-            map_add(&ctx->map, &ctx->map_size, tind_old, tind_new, 1);
-            cursor++;
-            size_t base = 512 + 512 + (size_t)ctx->sb->data_offset * (size_t)ctx->sb->blocksize;
-            size_t tind_abs = base + (size_t)tind_old * (size_t)ctx->sb->blocksize;
-            const unsigned char *tp = ctx->in_buf + tind_abs;
-            for (int k = 0; k < ptrs_per_block && remaining > 0; ++k) {
-                int dind_old = safe_read_int_le(tp + (size_t)k * 4);
-                if (dind_old == -1) break;
-                int dind_new = cursor;
-                map_add(&ctx->map, &ctx->map_size, dind_old, dind_new, 1);
-                cursor++;
-                size_t dind_abs = base + (size_t)dind_old * (size_t)ctx->sb->blocksize;
-                const unsigned char *dp = ctx->in_buf + dind_abs;
-                for (int d = 0; d < ptrs_per_block && remaining > 0; ++d) {
-                    int single_block_old = safe_read_int_le(dp + (size_t)d * 4);
-                    if (single_block_old == -1) break;
-                    int single_block_new = cursor;
-                    map_add(&ctx->map, &ctx->map_size, single_block_old, single_block_new, 1);
-                    cursor++;
-                    size_t single_abs = base + (size_t)single_block_old * (size_t)ctx->sb->blocksize;
-                    const unsigned char *sp = ctx->in_buf + single_abs;
-                    for (int s = 0; s < ptrs_per_block && remaining > 0; ++s) {
-                        int old_data_idx = safe_read_int_le(sp + (size_t)s * 4);
-                        if (old_data_idx == -1) break;
-                        int new_data_idx = cursor;
-                        map_add(&ctx->map, &ctx->map_size, old_data_idx, new_data_idx, 0);
-                        cursor++;
-                        remaining--;
-                    }
-                }
-            }
+            if (map_indirect(ctx, &src, &fr->raw->i3block, 1, 3, &cursor, &remaining) != 0) return -1;
         }
+    }
 
+    /* Every later pass indexes the data region with these */
+    int total = ctx->sb->swap_offset - ctx->sb->data_offset;
+    for (int m = 0; m < ctx->map_size; ++m) {
+        if (ctx->map[m].old_index < 0 || ctx->map[m].old_index >= total ||
+            ctx->map[m].new_index < 0 || ctx->map[m].new_index >= total) {
+            return BLOCK_MAP_ERR_RANGE;
+        }
     }
+    return 0;
+}
 
+int build_remap_table(RewriteContext *ctx) {
+    int total = ctx->sb->swap_offset - ctx->sb->data_offset;
+    defrag_mem_free(ctx->alloc, ctx->new_of_old);
+    ctx->new_of_old = (int *)defrag_mem_alloc(ctx->alloc, sizeof(int) * (size_t)(total > 0 ? total : 1));
+    if (!ctx->new_of_old) return -1;
+    for (int i = 0; i < total; ++i) ctx->new_of_old[i] = -1;
+    for (int m = 0; m < ctx->map_size; ++m) {
+        int old = ctx->map[m].old_index;
+        if (old < 0 || old >= total) {
+            defrag_mem_free(ctx->alloc, ctx->new_of_old);
+            ctx->new_of_old = NULL;
+            return -1;
+        }
+        ctx->new_of_old[old] = ctx->map[m].new_index;
+    }
     return 0;
 }
 
+void remap_inode(struct inode *out, const struct inode *raw, block_remap_fn remap, const void *map_ctx) {
+    /* Copy inode fields from input raw first */
+    memcpy(out, raw, sizeof(struct inode));
+    /* Rewrite direct blocks */
+    for (int j = 0; j < N_DBLOCKS; ++j) {
+        out->dblocks[j] = raw->dblocks[j] == -1 ? -1 : remap(map_ctx, raw->dblocks[j]);
+    }
+    /* Rewrite single indirect pointers (indices to pointer blocks) */
+    for (int k = 0; k < N_IBLOCKS; ++k) {
+        out->iblocks[k] = raw->iblocks[k] == -1 ? -1 : remap(map_ctx, raw->iblocks[k]);
+    }
+    /* Rewrite double and triple */
+    out->i2block = raw->i2block == -1 ? -1 : remap(map_ctx, raw->i2block);
+    out->i3block = raw->i3block == -1 ? -1 : remap(map_ctx, raw->i3block);
+}
+
 int rewrite_inodes(RewriteContext *ctx) {
     if (!ctx || !ctx->out_buf || !ctx->sb) return -1;
     /* Compute region starts */
@@ -147,44 +171,16 @@ int rewrite_inodes(RewriteContext *ctx) {
     /* For each record, write updated pointers into inode slot */
     for (int i = 0; i < ctx->count; ++i) {
         const FileRecord *fr = &ctx->records[i];
-        const FilePlacement *pl = &ctx->placements[i];
         size_t off = inode_start + (size_t)fr->inode_index * sizeof(struct inode);
-        struct inode *out_inode = (struct inode *)(ctx->out_buf + off);
-        /* Copy inode fields from input raw first */
-        memcpy(out_inode, fr->raw, sizeof(struct inode));
-        /* Rewrite direct blocks */
-        for (int j = 0; j < N_DBLOCKS; ++j) {
-            int old = fr->raw->dblocks[j];
-            if (old == -1) { out_inode->dblocks[j] = -1; continue; }
-            int mapped = map_lookup(ctx, old);
-            out_inode->dblocks[j] = mapped;
-        }
-        /* Rewrite single indirect pointers (indices to pointer blocks) */
-        for (int k = 0; k < N_IBLOCKS; ++k) {
-            int oldp = fr->raw->iblocks[k];
-            if (oldp == -1) { out_inode->iblocks[k] = -1; continue; }
-            int mappedp = map_lookup(ctx, oldp);
-            out_inode->iblocks[k] = mappedp;
-        }
-        /* Rewrite double and triple */
-        if (fr->raw->i2block != -1) {
-            out_inode->i2block = map_lookup(ctx, fr->raw->i2block);
-        } else {
-            out_inode->i2block = -1;
-        }
-        if (fr->raw->i3block != -1) {
-            out_inode->i3block = map_lookup(ctx, fr->raw->i3block);
-        } else {
-            out_inode->i3block = -1;
-        }
+        remap_inode((struct inode *)(ctx->out_buf + off), fr->raw, ctx_remap, ctx);
     }
     return 0;
 }
 
 int rewrite_pointer_blocks(RewriteContext *ctx) {
-    if (!ctx || !ctx->in_buf || !ctx->out_buf || !ctx->sb) return -1;
+    if (!ctx || !ctx->in_buf || !ctx->out_buf || !ctx->sb || !ctx->ops || !ctx->new_of_old) return -1;
+    int total = ctx->sb->swap_offset - ctx->sb->data_offset;
     size_t data_base = 512 + 512 + (size_t)ctx->sb->data_offset * (size_t)ctx->sb->blocksize;
-    int ptrs_per_block = ctx->sb->blocksize / 4;
     /* Iterate mapping entries; only rewrite pointer blocks */
     for (int m = 0; m < ctx->map_size; ++m) {
         if (ctx->map[m].is_pointer != 1) continue;
@@ -194,41 +190,106 @@ int rewrite_pointer_blocks(RewriteContext *ctx) {
            We can't distinguish here; rewrite both pointer and data safely:
            For pointer blocks, entries are 4-byte ints; for data blocks, just raw copy.
            We'll attempt to rewrite as pointer block if its contents look like indices or -1. */
-        size_t old_abs = data_base + (size_t)old_idx * (size_t)ctx->sb->blocksize;
-        size_t new_abs = data_base + (size_t)new_idx * (size_t)ctx->sb->blocksize;
-        const unsigned char *src = ctx->in_buf + old_abs;
-        unsigned char *dst = ctx->out_buf + new_abs;
+        size_t old_abs = data_base + block_ops_offset(ctx->ops, old_idx);
+        size_t new_abs = data_base + block_ops_offset(ctx->ops, new_idx);
         /* Rewrite pointer block: map each int if not -1 */
-        for (int i = 0; i < ptrs_per_block; ++i) {
-            int val = safe_read_int_le(src + (size_t)i * 4);
-            int outv = val;
-            if (val != -1) {
-                int mapped = map_lookup(ctx, val);
-                if (mapped != -1) outv = mapped; else outv = val;
-            }
-            /* Write little-endian */
-            dst[i*4 + 0] = (unsigned char)(outv & 0xFF);
-            dst[i*4 + 1] = (unsigned char)((outv >> 8) & 0xFF);
-            dst[i*4 + 2] = (unsigned char)((outv >> 16) & 0xFF);
-            dst[i*4 + 3] = (unsigned char)((outv >> 24) & 0xFF);
-        }
-        /* Zero remainder beyond pointer array */
-        memset(dst + (size_t)ptrs_per_block * 4, 0, (size_t)ctx->sb->blocksize - (size_t)ptrs_per_block * 4);
+        ctx->ops->remap_pointers(ctx->out_buf + new_abs, ctx->in_buf + old_abs,
+                                 (size_t)ctx->sb->blocksize, ctx->new_of_old, total);
     }
     return 0;
 }
 
-int rewrite_data_blocks(RewriteContext *ctx) {
-    if (!ctx || !ctx->in_buf || !ctx->out_buf || !ctx->sb) return -1;
+void rewrite_block_to(const RewriteContext *ctx, int m, unsigned char *dst) {
+    size_t data_base = 512 + 512 + (size_t)ctx->sb->data_offset * (size_t)ctx->sb->blocksize;
+    const unsigned char *src = ctx->in_buf + data_base + block_ops_offset(ctx->ops, ctx->map[m].old_index);
+    if (ctx->map[m].is_pointer == 1) {
+        ctx->ops->remap_pointers(dst, src, (size_t)ctx->sb->blocksize, ctx->new_of_old,
+                                 ctx->sb->swap_offset - ctx->sb->data_offset);
+        return;
+    }
+    ctx->ops->copy_block(dst, src, (size_t)ctx->sb->blocksize);
+}
+
+void rewrite_inode_to(const RewriteContext *ctx, int r, struct inode *out) {
+    remap_inode(out, ctx->records[r].raw, ctx_remap, ctx);
+}
+
+int *map_by_new_index(const RewriteContext *ctx, int total) {
+    int *by_new = (int *)defrag_mem_alloc(ctx->alloc, sizeof(int) * (size_t)(total > 0 ? total : 1));
+    if (!by_new) return NULL;
+    for (int i = 0; i < total; ++i) by_new[i] = -1;
+    for (int m = 0; m < ctx->map_size; ++m) {
+        int n = ctx->map[m].new_index;
+        if (n < 0 || n >= total || by_new[n] != -1) {
+            defrag_mem_free(ctx->alloc, by_new);
+            return NULL;
+        }
+        by_new[n] = m;
+    }
+    return by_new;
+}
+
+/* Number of pending reads sorted together before they are scattered into the
+   output. Bounds the scheduler's memory while still turning random source
+   reads into mostly ascending sweeps. */
+#define GATHER_BATCH_BLOCKS 4096
+
+typedef struct {
+    int old_index;
+    int new_index;
+    int map_pos; /* entry in ctx->map, for per-block hashes */
+} GatherSlot;
+
+static int cmp_gather_old(const void *a, const void *b) {
+    int x = ((const GatherSlot *)a)->old_index;
+    int y = ((const GatherSlot *)b)->old_index;
+    return (x > y) - (x < y);
+}
+
+/* Blocks skipped when reading 'next' right after 'prev' (0 when sequential) */
+static long long seek_distance(int prev, int next) {
+    long long d = (long long)next - ((long long)prev + 1);
+    return d < 0 ? -d : d;
+}
+
+static void gather_flush(RewriteContext *ctx, GatherSlot *batch, int n, int *prev_read) {
     size_t data_base = 512 + 512 + (size_t)ctx->sb->data_offset * (size_t)ctx->sb->blocksize;
-    /* Copy only data blocks using mapping; pointer blocks handled separately */
+    qsort(batch, (size_t)n, sizeof(GatherSlot), cmp_gather_old);
+    for (int i = 0; i < n; ++i) {
+        size_t old_abs = data_base + block_ops_offset(ctx->ops, batch[i].old_index);
+        size_t new_abs = data_base + block_ops_offset(ctx->ops, batch[i].new_index);
+        ctx->ops->copy_block(ctx->out_buf + new_abs, ctx->in_buf + old_abs, (size_t)ctx->sb->blocksize);
+        if (ctx->hashes) {
+            ctx->hashes[batch[i].map_pos] = block_hash(ctx->in_buf + old_abs, (size_t)ctx->sb->blocksize);
+        }
+        ctx->seek_sorted += seek_distance(*prev_read, batch[i].old_index);
+        *prev_read = batch[i].old_index;
+    }
+}
+
+int rewrite_data_blocks(RewriteContext *ctx) {
+    if (!ctx || !ctx->in_buf || !ctx->out_buf || !ctx->sb || !ctx->ops) return -1;
+    GatherSlot *batch = (GatherSlot *)defrag_mem_alloc(ctx->alloc, sizeof(GatherSlot) * GATHER_BATCH_BLOCKS);
+    if (!batch) return -1;
+    ctx->seek_unsorted = 0;
+    ctx->seek_sorted = 0;
+    int pending = 0;
+    int prev_unsorted = -1, prev_sorted = -1;
+    /* Phase 1 collects data blocks (pointer blocks handled separately) in layout
+       order; phase 2 reads each batch in ascending source order and scatters. */
     for (int m = 0; m < ctx->map_size; ++m) {
         if (ctx->map[m].is_pointer == 1) continue;
-        int old_idx = ctx->map[m].old_index;
-        int new_idx = ctx->map[m].new_index;
-        size_t old_abs = data_base + (size_t)old_idx * (size_t)ctx->sb->blocksize;
-        size_t new_abs = data_base + (size_t)new_idx * (size_t)ctx->sb->blocksize;
-        memcpy(ctx->out_buf + new_abs, ctx->in_buf + old_abs, (size_t)ctx->sb->blocksize);
+        ctx->seek_unsorted += seek_distance(prev_unsorted, ctx->map[m].old_index);
+        prev_unsorted = ctx->map[m].old_index;
+        batch[pending].old_index = ctx->map[m].old_index;
+        batch[pending].new_index = ctx->map[m].new_index;
+        batch[pending].map_pos = m;
+        if (++pending == GATHER_BATCH_BLOCKS) {
+            gather_flush(ctx, batch, pending, &prev_sorted);
+            pending = 0;
+        }
     }
+    if (pending > 0) gather_flush(ctx, batch, pending, &prev_sorted);
+    defrag_mem_free(ctx->alloc, batch);
     return 0;
 }
@@ -1,9 +1,13 @@
 #ifndef BLOCK_REWRITE_H
 #define BLOCK_REWRITE_H
 
+#include <stdint.h>
 #include "superblock_def.h"
 #include "file_records.h"
 #include "layout_plan.h"
+#include "block_ops.h"
+#include "inode_scan.h"
+#include "defrag_alloc.h"
 
 typedef struct {
 	int old_index; /* old data-region block index */
@@ -13,6 +17,8 @@ typedef struct {
 
 typedef struct {
 	const struct superblock *sb;
+	const BlockOps *ops; /* kernels selected for sb->blocksize */
+	const DefragAllocator *alloc; /* NULL for the C library; owns map */
 	const unsigned char *in_buf;
 	unsigned char *out_buf;
 	const FileRecord *records;
@@ -20,11 +26,36 @@ typedef struct {
 	int count; /* number of files */
 	BlockMapEntry *map; /* dynamic array of mappings */
 	int map_size;
+	int map_cap;  /* entries allocated; build_block_mapping grows map geometrically */
+	/* Gather statistics from rewrite_data_blocks, in blocks skipped between reads */
+	long long seek_unsorted; /* distance if reads were issued in new-layout order */
+	long long seek_sorted;   /* distance actually incurred with batched elevator order */
+	uint64_t *hashes;        /* optional, indexed like map: block_hash of each data block copied */
+	int *new_of_old;         /* build_remap_table: new index per old data block, -1 if unmapped */
 } RewriteContext;
 
-int build_block_mapping(RewriteContext *ctx); /* enumerate pointer+data blocks and fill map */
+/* build_block_mapping: enumerate pointer+data blocks and fill map. Returns 0,
+	-1 on allocation failure, or BLOCK_MAP_ERR_RANGE when an inode or pointer
+	block names a block outside the data region (or the layout overflows it). */
+#define BLOCK_MAP_ERR_RANGE -2
+int build_block_mapping(RewriteContext *ctx);
+/* Index the map by old block (O(1) remaps for the rewrite passes); call again
+	whenever new indices change. -1 on allocation failure or an out-of-range index. */
+int build_remap_table(RewriteContext *ctx);
 int rewrite_inodes(RewriteContext *ctx);      /* update inode pointers to new indices */
-int rewrite_pointer_blocks(RewriteContext *ctx); /* copy pointer blocks with remapped entries */
-int rewrite_data_blocks(RewriteContext *ctx); /* copy file payload blocks */
+/* One inode: raw with every block pointer passed through remap */
+void remap_inode(struct inode *out, const struct inode *raw, block_remap_fn remap, const void *map_ctx);
+int rewrite_pointer_blocks(RewriteContext *ctx); /* copy pointer blocks with remapped entries; needs build_remap_table */
+int rewrite_data_blocks(RewriteContext *ctx); /* copy file payload blocks in source-sorted batches */
+/* Produce the new contents of map entry m into dst (one block): remapped
+	pointers (needs build_remap_table) or a copy of the data block. Reads
+	ctx only, so concurrent callers are fine. */
+void rewrite_block_to(const RewriteContext *ctx, int m, unsigned char *dst);
+/* New contents of records[r]'s inode slot, into out (needs build_remap_table) */
+void rewrite_inode_to(const RewriteContext *ctx, int r, struct inode *out);
+/* Inverse of the map: map position of each new block index in [0, total),
+	-1 where none; NULL on allocation failure or a duplicate/out-of-range
+	index. Free with defrag_mem_free(ctx->alloc, ...). */
+int *map_by_new_index(const RewriteContext *ctx, int total);
 
 #endif /* BLOCK_REWRITE_H */
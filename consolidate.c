@@ -0,0 +1,74 @@
+#include "consolidate.h"
+#include "defrag_alloc.h"
+#include <stdlib.h>
+#include <string.h>
+
+long long count_moved_blocks(const BlockMapEntry *map, int map_size) {
+    long long moved = 0;
+    for (int m = 0; m < map_size; ++m) {
+        if (map[m].old_index != map[m].new_index) moved++;
+    }
+    return moved;
+}
+
+int count_moved_files(const BlockMapEntry *map, int map_size, const FilePlacement *placements, int count) {
+    int files = 0, m = 0;
+    for (int i = 0; i < count; ++i) {
+        int n = placements[i].pointer_block_count + placements[i].data_block_count;
+        int moved = 0;
+        for (int k = 0; k < n && m < map_size; ++k, ++m) {
+            if (map[m].old_index != map[m].new_index) moved = 1;
+        }
+        files += moved;
+    }
+    return files;
+}
+
+int consolidate_free(BlockMapEntry *map,
+                     int map_size,
+                     FilePlacement *placements,
+                     int count,
+                     int total_data_blocks,
+                     ConsolidateStats *stats,
+                     const DefragAllocator *alloc) {
+    if ((map_size > 0 && !map) || (count > 0 && !placements) || !stats) return -1;
+    if (map_size > total_data_blocks) return -1;
+    memset(stats, 0, sizeof(*stats));
+
+    unsigned char *used = (unsigned char *)defrag_mem_calloc(alloc, (size_t)total_data_blocks, 1);
+    if (!used) return -1;
+    for (int m = 0; m < map_size; ++m) {
+        int old = map[m].old_index;
+        if (old < 0 || old >= total_data_blocks || used[old]) {
+            defrag_mem_free(alloc, used); /* out of range or shared block: not a valid image */
+            return -1;
+        }
+        used[old] = 1;
+    }
+
+    /* Every block at or beyond the boundary needs a hole below it, and there
+       are exactly as many holes as such blocks. Holes are handed out in
+       ascending order file by file, so a file's moved blocks stay together. */
+    int boundary = map_size;
+    int hole = 0;
+    for (int m = 0; m < map_size; ++m) {
+        if (map[m].old_index < boundary) {
+            map[m].new_index = map[m].old_index;
+            continue;
+        }
+        while (used[hole]) hole++;
+        map[m].new_index = hole++;
+    }
+    defrag_mem_free(alloc, used);
+
+    int m = 0;
+    for (int i = 0; i < count; ++i) {
+        int n = placements[i].pointer_block_count + placements[i].data_block_count;
+        if (n > 0 && m < map_size) placements[i].start_block = map[m].new_index;
+        m += n;
+    }
+    stats->files_moved = count_moved_files(map, map_size, placements, count);
+    stats->used_blocks = boundary;
+    stats->moved_blocks = count_moved_blocks(map, map_size);
+    return 0;
+}
@@ -0,0 +1,34 @@
+#ifndef CONSOLIDATE_H
+#define CONSOLIDATE_H
+
+#include "layout_plan.h"
+#include "block_rewrite.h"
+#include "defrag_alloc.h"
+
+typedef struct {
+	int used_blocks;          /* free space starts here afterwards */
+	long long moved_blocks;   /* blocks whose index changes */
+	int files_moved;          /* files with at least one moved block */
+} ConsolidateStats;
+
+/* Turn a full-defrag block map (every used block of every file, file by
+	file) into a minimal-move one: blocks already below the used-block count
+	stay put and only blocks beyond it move, into the holes below it, so the
+	free space becomes one ascending tail. Pointer blocks are relocated like
+	any other block; rewrite_pointer_blocks/rewrite_inodes then fix up the
+	references. placements[i].start_block becomes the file's first new block
+	(files are no longer contiguous). Returns 0 on success. */
+int consolidate_free(BlockMapEntry *map,
+					 int map_size,
+					 FilePlacement *placements,
+					 int count,
+					 int total_data_blocks,
+					 ConsolidateStats *stats,
+					 const DefragAllocator *alloc);
+
+/* Blocks a map moves (old_index != new_index) */
+long long count_moved_blocks(const BlockMapEntry *map, int map_size);
+/* Files with at least one moved block; the map lists files in placement order */
+int count_moved_files(const BlockMapEntry *map, int map_size, const FilePlacement *placements, int count);
+
+#endif /* CONSOLIDATE_H */
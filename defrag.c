@@ -2,17 +2,21 @@
 #include <stdlib.h>
 #include <string.h>
 #include "disk_image.h"
-#include "inode_scan.h"
-#include "layout_plan.h"
-#include "block_rewrite.h"
-#include "file_records.h"
-#include "freelist.h"
+#include "libdefrag.h"
 #include "verify.h"
+#include "delta.h"
+#include "plan_file.h"
+#include "remap_log.h"
+#include "manifest.h"
+#include "image_buffer.h"
 #include "util.h"
 #include "superblock_def.h"
 #include <sys/stat.h>
+#include <unistd.h>
 
 static int verbose = 0;
+/* Progress and reports; stderr when the image itself goes to stdout */
+static FILE *msg;
 
 static int load_file(const char *path, unsigned char **buf, size_t *size) {
 	struct stat st;
@@ -27,216 +31,353 @@ static int load_file(const char *path, unsigned char **buf, size_t *size) {
 	*buf = b; *size = rd; return 0;
 }
 
-static int compare_images(const char *pathA, const char *pathB) {
-	unsigned char *a = NULL, *b = NULL; size_t sa = 0, sb = 0;
-	if (load_file(pathA, &a, &sa) != 0) return -1;
-	if (load_file(pathB, &b, &sb) != 0) { free(a); return -1; }
+static int compare_with_file(const unsigned char *a, size_t sa, const char *path) {
+	unsigned char *b = NULL; size_t sb = 0;
+	if (load_file(path, &b, &sb) != 0) return -1;
 	int eq = (sa == sb) && (memcmp(a, b, sa) == 0);
-	free(a); free(b);
+	free(b);
 	return eq ? 0 : 1;
 }
 
+static void report_buffers(const ImageBuffer *in, const ImageBuffer *out) {
+	ImageBufferStats st;
+	image_buffer_stats(&st);
+	fprintf(msg, "Buffers: input %s%s, output %s%s", image_buffer_backing_name(in->backing),
+			in->interleaved ? " interleaved" : "", image_buffer_backing_name(out->backing),
+			out->interleaved ? " interleaved" : "");
+	if (st.huge_kb >= 0) fprintf(msg, "; %lld kB in huge pages", st.huge_kb);
+	for (int n = 0; n < st.nodes; ++n) fprintf(msg, "%s N%d=%lld", n ? "" : "; pages per node", n, st.node_pages[n]);
+	fprintf(msg, "\n");
+}
+
+/* --serve-view: each stdin line "<offset> <length>" is answered on stdout
+   with that range of the defragmented image, clamped to its end */
+static int serve_view_requests(const DefragContext *dctx, size_t image_size) {
+	enum { CHUNK = 1 << 20 };
+	unsigned char *chunk = (unsigned char *)malloc(CHUNK);
+	if (!chunk) return DEFRAG_ERR_NOMEM;
+	char line[128];
+	long long requests = 0, bytes = 0;
+	int rc = DEFRAG_OK;
+	while (rc == DEFRAG_OK && fgets(line, sizeof(line), stdin)) {
+		unsigned long long off, len;
+		if (sscanf(line, "%llu %llu", &off, &len) != 2) {
+			fprintf(msg, "serve-view: ignoring malformed request: %s", line);
+			continue;
+		}
+		if (off > image_size) off = image_size;
+		if (len > image_size - off) len = image_size - off;
+		while (len > 0 && rc == DEFRAG_OK) {
+			size_t got = 0;
+			rc = defrag_view_read(dctx, (size_t)off, chunk, len < CHUNK ? (size_t)len : CHUNK, &got);
+			if (rc == DEFRAG_OK && fwrite(chunk, 1, got, stdout) != got) rc = DEFRAG_ERR_IO;
+			off += got;
+			len -= got;
+			bytes += (long long)got;
+		}
+		if (fflush(stdout) != 0) rc = DEFRAG_ERR_IO;
+		requests++;
+	}
+	free(chunk);
+	if (verbose) fprintf(msg, "Served %lld requests, %lld bytes\n", requests, bytes);
+	return rc;
+}
+
 int main(int argc, char *argv[]) {
 	const char *input_path = NULL;
 	const char *verify_path = NULL;
-	/* Args: defrag [-q] <input> [--verify <expected>] */
+	const char *delta_path = NULL;
+	const char *apply_delta_path = NULL;
+	const char *emit_plan_path = NULL;
+	const char *apply_plan_path = NULL;
+	const char *remap_log_path = NULL;
+	const char *manifest_path = NULL;
+	const char *check_manifest_path = NULL;
+	const char *check_output_path = NULL;
+	const char *output_path = NULL;
+	int consolidate = 0;
+	int serve_view = 0;
+	msg = stdout;
+	/* Args: defrag [-q|-v] <input> [-o <output>|-] [--verify <expected>] [--delta <patch>] [--consolidate-free]
+	                [--emit-plan <plan> | --apply-plan <plan>] [--remap-log <file>] [--manifest <file>]
+	         defrag [-q|-v] <input> --serve-view [--apply-plan <plan> | --consolidate-free]
+	         defrag [-q|-v] <source> --check-manifest <manifest> <output>
+	         defrag [-q|-v] --apply-delta <patch> <image> */
 	for (int i = 1; i < argc; ++i) {
 		if (strcmp(argv[i], "-q") == 0) { verbose = 0; continue; }
+		if (strcmp(argv[i], "-v") == 0) { verbose = 1; continue; }
+		if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) { output_path = argv[++i]; continue; }
 		if (strcmp(argv[i], "--verify") == 0 && i + 1 < argc) { verify_path = argv[++i]; continue; }
+		if (strcmp(argv[i], "--delta") == 0 && i + 1 < argc) { delta_path = argv[++i]; continue; }
+		if (strcmp(argv[i], "--apply-delta") == 0 && i + 1 < argc) { apply_delta_path = argv[++i]; continue; }
+		if (strcmp(argv[i], "--emit-plan") == 0 && i + 1 < argc) { emit_plan_path = argv[++i]; continue; }
+		if (strcmp(argv[i], "--apply-plan") == 0 && i + 1 < argc) { apply_plan_path = argv[++i]; continue; }
+		if (strcmp(argv[i], "--remap-log") == 0 && i + 1 < argc) { remap_log_path = argv[++i]; continue; }
+		if (strcmp(argv[i], "--manifest") == 0 && i + 1 < argc) { manifest_path = argv[++i]; continue; }
+		if (strcmp(argv[i], "--consolidate-free") == 0) { consolidate = 1; continue; }
+		if (strcmp(argv[i], "--serve-view") == 0) { serve_view = 1; continue; }
+		if (strcmp(argv[i], "--check-manifest") == 0 && i + 2 < argc) {
+			check_manifest_path = argv[++i];
+			check_output_path = argv[++i];
+			continue;
+		}
 		if (!input_path) { input_path = argv[i]; continue; }
 	}
-	if (!input_path) {
-		fprintf(stderr, "Usage: %s [-q] <input_disk_image> [--verify <expected_image>]\n", argv[0]);
+	/* "-o -" streams to stdout and never holds the whole output image */
+	int to_stdout = output_path && strcmp(output_path, "-") == 0;
+	if (!input_path || (emit_plan_path && apply_plan_path) || (consolidate && apply_plan_path) ||
+		(output_path && delta_path) || (to_stdout && verify_path) ||
+		(serve_view && (output_path || delta_path || verify_path || emit_plan_path || manifest_path))) {
+		fprintf(stderr, "Usage: %s [-q|-v] <input_disk_image> [-o <output_image>|-] [--verify <expected_image>] [--delta <patch>] [--consolidate-free]\n"
+				"                [--emit-plan <plan> | --apply-plan <plan>] [--remap-log <file>] [--manifest <file>]\n"
+				"       %s [-q|-v] <input_disk_image> --serve-view [--apply-plan <plan> | --consolidate-free]\n"
+				"       %s [-q|-v] <source_image> --check-manifest <manifest> <output_image>\n"
+				"       %s [-q|-v] --apply-delta <patch> <disk_image>\n", argv[0], argv[0], argv[0], argv[0]);
 		return 1;
 	}
+	if (to_stdout || serve_view) msg = stderr;
 
-	unsigned char *in_buf = NULL;
-	size_t in_size = 0;
-	if (load_disk_image(input_path, &in_buf, &in_size) != 0) {
-		fatal("Failed to load disk image");
+	if (apply_delta_path) {
+		DeltaStats ds;
+		if (apply_delta(apply_delta_path, input_path, &ds) != 0) {
+			fatal("Failed to apply delta '%s' to '%s'", apply_delta_path, input_path);
+		}
+		if (verbose) {
+			fprintf(msg, "Applied delta: %lld writes (%lld bytes), %lld copies (%lld bytes)\n",
+				   ds.write_records, ds.bytes_literal, ds.copy_records, ds.bytes_copied);
+		}
+		return 0;
 	}
 
-	struct superblock sb;
-	if (parse_superblock(in_buf, &sb) != 0) {
-		fatal("Failed to parse superblock");
+	if (check_manifest_path) {
+		ManifestCheck mc;
+		if (check_manifest(check_manifest_path, input_path, check_output_path, &mc) != 0) {
+			fatal("Cannot read manifest '%s'", check_manifest_path);
+		}
+		const ManifestImageResult *res[2] = { &mc.source, &mc.output };
+		const char *names[2] = { input_path, check_output_path };
+		int bad = 0;
+		for (int k = 0; k < 2; ++k) {
+			if (res[k]->error) {
+				fprintf(msg, "Manifest: %s: cannot read image or blocksize differs\n", names[k]);
+			} else {
+				fprintf(msg, "Manifest: %s: %lld blocks checked, %lld mismatched, %lld missing\n",
+					   names[k], res[k]->checked, res[k]->mismatched, res[k]->missing);
+			}
+			if (res[k]->error || res[k]->mismatched || res[k]->missing) bad = 1;
+		}
+		fprintf(msg, "Manifest: %s\n", bad ? "contents differ" : "contents identical");
+		return bad ? 1 : 0;
+	}
+
+	/* Whole-image buffers come from the huge-page/NUMA-aware allocator */
+	ImageBuffer in_img, out_img;
+	if (image_buffer_load(&in_img, input_path) != 0) {
+		fatal("Cannot read input image '%s'", input_path);
 	}
+	const unsigned char *in_buf = in_img.data;
+	size_t in_size = in_img.size;
+
+	DefragContext *dctx = defrag_create(NULL);
+	if (!dctx) {
+		image_buffer_free(&in_img);
+		fatal("Cannot create defrag context");
+	}
+	int rc = defrag_load(dctx, in_buf, in_size);
+	if (rc != DEFRAG_OK) {
+		defrag_destroy(dctx);
+		image_buffer_free(&in_img);
+		fatal("Failed to parse superblock: %s", defrag_strerror(rc));
+	}
+	DefragInfo info;
+	defrag_info(dctx, &info);
+	const struct superblock *sb = info.sb;
 
 	if (verbose) {
-		printf("Superblock:\n");
-		printf("  blocksize    = %d\n", sb.blocksize);
-		printf("  inode_offset = %d blocks\n", sb.inode_offset);
-		printf("  data_offset  = %d blocks\n", sb.data_offset);
-		printf("  swap_offset  = %d blocks\n", sb.swap_offset);
-		printf("  free_inode   = %d\n", sb.free_inode);
-		printf("  free_block   = %d\n", sb.free_block);
-		printf("Image size: %zu bytes\n", in_size);
-	}
-
-	/* Scan inodes and print summary */
-	int inode_used_count = 0;
-	/* First pass to get count */
-	if (scan_inodes(in_buf, &sb, NULL, &inode_used_count) != 0) {
-		fatal("Failed to scan inodes");
-	}
-	if (verbose) printf("Used inodes: %d\n", inode_used_count);
-
-	/* Build FileRecords from used inodes (direct blocks for now) */
-	if (inode_used_count > 0) {
-		/* Re-scan to get views again */
-		InodeView *views = (InodeView *)malloc(sizeof(InodeView) * (size_t)inode_used_count);
-		int tmp = 0;
-		if (!views || scan_inodes(in_buf, &sb, views, &tmp) != 0 || tmp != inode_used_count) {
-			free(views);
-			fatal("Failed to prepare InodeView for records");
-		}
-		FileRecord *records = NULL; int rec_count = 0;
-		if (build_file_records(in_buf, &sb, views, inode_used_count, &records, &rec_count) != 0) {
-			free(views);
-			fatal("Failed to build file records");
+		fprintf(msg, "Superblock:\n");
+		fprintf(msg, "  blocksize    = %d\n", sb->blocksize);
+		fprintf(msg, "  inode_offset = %d blocks\n", sb->inode_offset);
+		fprintf(msg, "  data_offset  = %d blocks\n", sb->data_offset);
+		fprintf(msg, "  swap_offset  = %d blocks\n", sb->swap_offset);
+		fprintf(msg, "  free_inode   = %d\n", sb->free_inode);
+		fprintf(msg, "  free_block   = %d\n", sb->free_block);
+		fprintf(msg, "Image size: %zu bytes\n", in_size);
+		fprintf(msg, "Block kernels: %s\n", info.kernels);
+	}
+
+	/* Scan, plan and map blocks, or take all of that from a saved plan */
+	if (apply_plan_path) {
+		rc = defrag_load_plan(dctx, apply_plan_path);
+	} else {
+		rc = consolidate ? defrag_plan_consolidate(dctx) : defrag_plan(dctx);
+	}
+	if (rc != DEFRAG_OK) {
+		defrag_destroy(dctx);
+		image_buffer_free(&in_img);
+		if (apply_plan_path) fatal("Failed to load plan '%s': %s", apply_plan_path, defrag_strerror(rc));
+		fatal("Layout planning failed: %s", defrag_strerror(rc));
+	}
+	defrag_info(dctx, &info);
+	if (verbose) {
+		fprintf(msg, "Used inodes: %d\n", info.count);
+		if (!apply_plan_path) {
+			for (int i = 0; i < info.count; ++i) {
+				fprintf(msg, "  file inode=%d blocks=%d direct=%d\n", info.records[i].inode_index,
+					   info.records[i].data_block_count, info.records[i].direct_count);
+			}
 		}
-		if (verbose) {
-			for (int i = 0; i < rec_count; ++i) {
-				printf("  file inode=%d blocks=%d direct=%d\n", records[i].inode_index,
-					   records[i].data_block_count, records[i].direct_count);
+		fprintf(msg, "Layout plan:\n");
+		for (int i = 0; i < info.count; ++i) {
+			fprintf(msg, "  inode=%d start=%d ptr_blocks=%d data_blocks=%d\n",
+				   info.placements[i].inode_index,
+				   info.placements[i].start_block,
+				   info.placements[i].pointer_block_count,
+				   info.placements[i].data_block_count);
+		}
+		fprintf(msg, "Next free block index: %d\n", info.next_free);
+		fprintf(msg, "Mappings built: %d entries\n", info.map_size);
+		if (consolidate) {
+			fprintf(msg, "Consolidate: moved %lld of %d used blocks (%lld bytes) from %d of %d files; "
+				   "full defrag moves %lld blocks (%lld bytes)\n",
+				   info.moved_blocks, info.map_size, info.moved_blocks * sb->blocksize, info.files_moved, info.count,
+				   info.full_moved_blocks, info.full_moved_blocks * sb->blocksize);
+		}
+	}
+
+	/* Old->new extents for downstream index updates */
+	if (remap_log_path) {
+		int extents = 0;
+		if (write_remap_log(remap_log_path, sb, info.map, info.map_size, &extents) != 0) {
+			defrag_destroy(dctx);
+			image_buffer_free(&in_img);
+			fatal("Failed to write remap log '%s'", remap_log_path);
+		}
+		if (verbose) fprintf(msg, "Wrote remap log %s: %d extents\n", remap_log_path, extents);
+	}
+
+	/* Answer reads of the defragmented image without building it */
+	if (serve_view) {
+		rc = defrag_view_open(dctx);
+		if (rc == DEFRAG_OK) rc = serve_view_requests(dctx, in_size);
+		defrag_destroy(dctx);
+		image_buffer_free(&in_img);
+		if (rc != DEFRAG_OK) fatal("Serving view failed: %s", defrag_strerror(rc));
+		return 0;
+	}
+
+	/* Planning only: persist the plan and stop before any data is copied */
+	if (emit_plan_path) {
+		rc = save_plan(emit_plan_path, sb, in_buf, in_size, info.placements, info.count,
+					   info.map, info.map_size, info.next_free);
+		defrag_destroy(dctx);
+		image_buffer_free(&in_img);
+		if (rc != 0) fatal("Failed to write plan '%s'", emit_plan_path);
+		if (verbose) fprintf(msg, "Wrote plan %s\n", emit_plan_path);
+		return 0;
+	}
+
+	/* Emit straight to stdout in file order; nothing to verify or diff */
+	if (to_stdout) {
+		if (manifest_path) defrag_set_block_hashes(dctx, 1);
+		rc = defrag_stream(dctx, STDOUT_FILENO);
+		if (rc != DEFRAG_OK) {
+			defrag_destroy(dctx);
+			image_buffer_free(&in_img);
+			fatal("Streaming output failed: %s", defrag_strerror(rc));
+		}
+		if (verbose) fprintf(msg, "Streamed %zu bytes to stdout\n", in_size);
+		if (manifest_path) {
+			defrag_info(dctx, &info);
+			rc = write_manifest(manifest_path, sb, info.placements, info.count,
+								info.map, info.map_size, info.block_hashes);
+			if (rc != 0) {
+				defrag_destroy(dctx);
+				image_buffer_free(&in_img);
+				fatal("Failed to write manifest '%s'", manifest_path);
 			}
+			if (verbose) fprintf(msg, "Wrote manifest %s\n", manifest_path);
 		}
+		defrag_destroy(dctx);
+		image_buffer_free(&in_img);
+		return 0;
+	}
 
-		/* Plan contiguous layout */
-		FilePlacement *placements = (FilePlacement *)malloc(sizeof(FilePlacement) * (size_t)rec_count);
-		int place_count = 0; int next_free = 0;
-		if (!placements || plan_layout(&sb, records, rec_count, placements, &place_count, &next_free) != 0) {
-			free(placements);
-			free_file_records(records, rec_count);
-			free(views);
-			fatal("Layout planning failed");
+	/* Prepare output buffer same size as input */
+	if (image_buffer_alloc(&out_img, in_size) != 0) {
+		defrag_destroy(dctx);
+		image_buffer_free(&in_img);
+		fatal("Cannot allocate output buffer");
+	}
+	unsigned char *out_buf = out_img.data;
+	TlbCounter tlb;
+	if (manifest_path) defrag_set_block_hashes(dctx, 1);
+	tlb_counter_start(&tlb);
+	rc = defrag_rewrite(dctx, out_buf);
+	long long tlb_misses = tlb_counter_stop(&tlb);
+	if (rc != DEFRAG_OK) {
+		image_buffer_free(&out_img);
+		defrag_destroy(dctx);
+		image_buffer_free(&in_img);
+		fatal("Rewrite failed: %s", defrag_strerror(rc));
+	}
+	defrag_info(dctx, &info);
+	if (verbose) {
+		fprintf(msg, "Gather: read seek distance %lld blocks (layout order %lld, saved %lld)\n",
+			   info.seek_sorted, info.seek_unsorted, info.seek_unsorted - info.seek_sorted);
+		report_buffers(&in_img, &out_img);
+		if (tlb_misses >= 0) fprintf(msg, "  dTLB load misses during rewrite: %lld\n", tlb_misses);
+		else fprintf(msg, "  dTLB load misses: not exposed by the kernel\n");
+	}
+
+	if (manifest_path) {
+		if (write_manifest(manifest_path, sb, info.placements, info.count,
+						   info.map, info.map_size, info.block_hashes) != 0) {
+			image_buffer_free(&out_img);
+			defrag_destroy(dctx);
+			image_buffer_free(&in_img);
+			fatal("Failed to write manifest '%s'", manifest_path);
+		}
+		if (verbose) fprintf(msg, "Wrote manifest %s\n", manifest_path);
+	}
+
+	/* Write output image, or only the changed blocks when a delta was requested */
+	if (delta_path) {
+		DeltaStats ds;
+		if (write_delta(delta_path, sb, in_buf, out_buf, in_size, info.map, info.map_size, &ds) != 0) {
+			image_buffer_free(&out_img);
+			defrag_destroy(dctx);
+			image_buffer_free(&in_img);
+			fatal("Failed to write delta '%s'", delta_path);
 		}
 		if (verbose) {
-			printf("Layout plan:\n");
-			for (int i = 0; i < place_count; ++i) {
-				printf("  inode=%d start=%d ptr_blocks=%d data_blocks=%d\n",
-					   placements[i].inode_index,
-					   placements[i].start_block,
-					   placements[i].pointer_block_count,
-					   placements[i].data_block_count);
-			}
-			printf("Next free block index: %d\n", next_free);
-		}
-
-		/* Build block mapping (direct + single-indirect) */
-		/* Prepare output buffer same size as input */
-		unsigned char *out_buf = (unsigned char *)malloc(in_size);
-		if (!out_buf) {
-			free(placements);
-			free_file_records(records, rec_count);
-			free(views);
-			fatal("malloc failed for output buffer");
-		}
-		/* Copy boot block and superblock as-is */
-		memcpy(out_buf, in_buf, 512 + 512);
-		/* Copy entire inode region from input before rewriting selected inodes */
-		size_t inode_region_abs = (512 + 512) + (size_t)sb.inode_offset * (size_t)sb.blocksize;
-		size_t inode_region_size = (size_t)(sb.data_offset - sb.inode_offset) * (size_t)sb.blocksize;
-		memcpy(out_buf + inode_region_abs, in_buf + inode_region_abs, inode_region_size);
-
-		RewriteContext ctx = {
-			.sb = &sb,
-			.in_buf = in_buf,
-			.out_buf = out_buf,
-			.records = records,
-			.placements = placements,
-			.count = rec_count,
-			.map = NULL,
-			.map_size = 0
-		};
-		if (build_block_mapping(&ctx) != 0) {
-			free(placements);
-			free_file_records(records, rec_count);
-			free(views);
-			fatal("Failed to build block mapping");
-		}
-		if (verbose) printf("Mappings built: %d entries\n", ctx.map_size);
-		/* Rewrite inodes (into output buffer) */
-		if (rewrite_inodes(&ctx) != 0) {
-			free(ctx.map);
-			free(out_buf);
-			free(placements);
-			free_file_records(records, rec_count);
-			free(views);
-			fatal("rewrite_inodes failed");
-		}
-		/* Rewrite pointer blocks */
-		if (rewrite_pointer_blocks(&ctx) != 0) {
-			free(ctx.map);
-			free(out_buf);
-			free(placements);
-			free_file_records(records, rec_count);
-			free(views);
-			fatal("rewrite_pointer_blocks failed");
-		}
-		/* Rewrite data blocks */
-		if (rewrite_data_blocks(&ctx) != 0) {
-			free(ctx.map);
-			free(out_buf);
-			free(placements);
-			free_file_records(records, rec_count);
-			free(views);
-			fatal("rewrite_data_blocks failed");
-		}
-
-		/* Rebuild free block list and update superblock free_block */
-		int total_data_blocks = sb.swap_offset - sb.data_offset; /* blocks in data region */
-		if (rebuild_free_block_list(out_buf, &sb, next_free, total_data_blocks) != 0) {
-			free(ctx.map);
-			free(out_buf);
-			free(placements);
-			free_file_records(records, rec_count);
-			free(views);
-			fatal("rebuild_free_block_list failed");
-		}
-
-		/* Do not alter inode free list; preserve original inode metadata except pointers */
-		/* Update free_block in superblock of out_buf */
-		size_t sb_off = 512; /* superblock starts after boot block */
-		int head = next_free;
-		out_buf[sb_off + 20] = (unsigned char)(head & 0xFF);
-		out_buf[sb_off + 21] = (unsigned char)((head >> 8) & 0xFF);
-		out_buf[sb_off + 22] = (unsigned char)((head >> 16) & 0xFF);
-		out_buf[sb_off + 23] = (unsigned char)((head >> 24) & 0xFF);
-
-		/* Copy swap region unchanged */
-		size_t swap_abs = (512 + 512) + (size_t)sb.swap_offset * (size_t)sb.blocksize;
-		size_t total_size = in_size;
-		memcpy(out_buf + swap_abs, in_buf + swap_abs, total_size - swap_abs);
-
-		/* Write output image */
-		if (write_disk_image("disk_defrag", out_buf, in_size) != 0) {
-			free(ctx.map);
-			free(out_buf);
-			free(placements);
-			free_file_records(records, rec_count);
-			free(views);
-			fatal("Failed to write disk_defrag");
-		}
-		if (verbose) printf("Wrote disk_defrag\n");
-
-		if (verify_path) {
-			int rc = compare_images("disk_defrag", verify_path);
-			if (rc == 0) {
-				printf("Verify: Images are identical\n");
-			} else if (rc > 0) {
-				printf("Verify: Images differ\n");
-			} else {
-				printf("Verify: Comparison failed\n");
-			}
+			fprintf(msg, "Wrote delta %s: %lld bytes for a %zu byte image\n", delta_path, ds.patch_size, in_size);
+			fprintf(msg, "  %lld writes (%lld bytes), %lld copies (%lld bytes)\n",
+				   ds.write_records, ds.bytes_literal, ds.copy_records, ds.bytes_copied);
 		}
+	} else {
+		if (!output_path) output_path = "disk_defrag";
+		if (write_disk_image(output_path, out_buf, in_size) != 0) {
+			image_buffer_free(&out_img);
+			defrag_destroy(dctx);
+			image_buffer_free(&in_img);
+			fatal("Failed to write %s", output_path);
+		}
+		if (verbose) fprintf(msg, "Wrote %s\n", output_path);
+	}
 
-		free(ctx.map);
-		free(out_buf);
-		free(placements);
-		free_file_records(records, rec_count);
-		free(views);
+	if (verify_path) {
+		int vrc = compare_with_file(out_buf, in_size, verify_path);
+		if (vrc == 0) {
+			fprintf(msg, "Verify: Images are identical\n");
+		} else if (vrc > 0) {
+			fprintf(msg, "Verify: Images differ\n");
+		} else {
+			fprintf(msg, "Verify: Comparison failed\n");
+		}
 	}
 
-	free(in_buf);
+	image_buffer_free(&out_img);
+	defrag_destroy(dctx);
+	image_buffer_free(&in_img);
 	return 0;
 }
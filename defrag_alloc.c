@@ -0,0 +1,32 @@
+#include "defrag_alloc.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+void *defrag_mem_alloc(const DefragAllocator *a, size_t size) {
+    if (size == 0) size = 1;
+    if (a) return a->alloc(a->opaque, size);
+    return malloc(size);
+}
+
+void *defrag_mem_calloc(const DefragAllocator *a, size_t count, size_t size) {
+    if (size != 0 && count > SIZE_MAX / size) return NULL;
+    void *p = defrag_mem_alloc(a, count * size);
+    if (p) memset(p, 0, count * size);
+    return p;
+}
+
+void *defrag_mem_realloc(const DefragAllocator *a, void *ptr, size_t size) {
+    if (size == 0) size = 1;
+    if (a) return a->resize(a->opaque, ptr, size);
+    return realloc(ptr, size);
+}
+
+void defrag_mem_free(const DefragAllocator *a, void *ptr) {
+    if (!ptr) return;
+    if (a) {
+        a->release(a->opaque, ptr);
+        return;
+    }
+    free(ptr);
+}
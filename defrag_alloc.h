@@ -0,0 +1,21 @@
+#ifndef DEFRAG_ALLOC_H
+#define DEFRAG_ALLOC_H
+
+#include <stddef.h>
+
+/* Caller-supplied allocator; all three callbacks must be set. A NULL
+	allocator means the C library. Zero-byte requests allocate one byte so
+	callers can keep treating NULL as failure. */
+typedef struct DefragAllocator {
+	void *(*alloc)(void *opaque, size_t size);
+	void *(*resize)(void *opaque, void *ptr, size_t size);
+	void (*release)(void *opaque, void *ptr);
+	void *opaque;
+} DefragAllocator;
+
+void *defrag_mem_alloc(const DefragAllocator *a, size_t size);
+void *defrag_mem_calloc(const DefragAllocator *a, size_t count, size_t size); /* zeroed */
+void *defrag_mem_realloc(const DefragAllocator *a, void *ptr, size_t size);
+void defrag_mem_free(const DefragAllocator *a, void *ptr);
+
+#endif /* DEFRAG_ALLOC_H */
@@ -0,0 +1,259 @@
+#include "delta.h"
+#include "disk_image.h"
+#include "util.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DELTA_MAGIC "DFDL"
+#define DELTA_RECORD_HEADER 20 /* type + offset + length */
+#define DELTA_IO_CHUNK (64 * 1024)
+
+static int put_u32(FILE *f, uint32_t v) {
+    unsigned char b[4];
+    for (int i = 0; i < 4; ++i) b[i] = (unsigned char)((v >> (8 * i)) & 0xFF);
+    return fwrite(b, 1, 4, f) == 4 ? 0 : -1;
+}
+
+static int put_u64(FILE *f, uint64_t v) {
+    unsigned char b[8];
+    for (int i = 0; i < 8; ++i) b[i] = (unsigned char)((v >> (8 * i)) & 0xFF);
+    return fwrite(b, 1, 8, f) == 8 ? 0 : -1;
+}
+
+static int get_u32(FILE *f, uint32_t *v) {
+    unsigned char b[4];
+    if (fread(b, 1, 4, f) != 4) return -1;
+    *v = 0;
+    for (int i = 0; i < 4; ++i) *v |= (uint32_t)b[i] << (8 * i);
+    return 0;
+}
+
+static int get_u64(FILE *f, uint64_t *v) {
+    unsigned char b[8];
+    if (fread(b, 1, 8, f) != 8) return -1;
+    *v = 0;
+    for (int i = 0; i < 8; ++i) *v |= (uint64_t)b[i] << (8 * i);
+    return 0;
+}
+
+/* Accumulates one pending record so adjacent writes/copies are coalesced */
+typedef struct {
+    FILE *f;
+    const unsigned char *out;
+    DeltaStats *stats;
+    int type; /* pending record type, DELTA_END if none */
+    size_t dst, src, len;
+    int err;
+} DeltaWriter;
+
+static void dw_flush(DeltaWriter *w) {
+    if (w->type == DELTA_END || w->err) {
+        w->type = DELTA_END;
+        return;
+    }
+    if (put_u32(w->f, (uint32_t)w->type) != 0 ||
+        put_u64(w->f, (uint64_t)w->dst) != 0 ||
+        put_u64(w->f, (uint64_t)w->len) != 0) {
+        w->err = 1;
+    } else if (w->type == DELTA_WRITE) {
+        if (fwrite(w->out + w->dst, 1, w->len, w->f) != w->len) w->err = 1;
+        w->stats->write_records++;
+        w->stats->bytes_literal += (long long)w->len;
+    } else {
+        if (put_u64(w->f, (uint64_t)w->src) != 0) w->err = 1;
+        w->stats->copy_records++;
+        w->stats->bytes_copied += (long long)w->len;
+    }
+    w->type = DELTA_END;
+}
+
+static void dw_write(DeltaWriter *w, size_t dst, size_t len) {
+    /* Absorb small unchanged gaps: cheaper than another record header */
+    if (w->type == DELTA_WRITE && dst >= w->dst + w->len &&
+        dst - (w->dst + w->len) <= DELTA_RECORD_HEADER) {
+        w->len = dst + len - w->dst;
+        return;
+    }
+    dw_flush(w);
+    w->type = DELTA_WRITE;
+    w->dst = dst;
+    w->len = len;
+}
+
+static void dw_copy(DeltaWriter *w, size_t dst, size_t src, size_t len) {
+    if (w->type == DELTA_COPY && dst == w->dst + w->len && src == w->src + w->len) {
+        w->len += len;
+        return;
+    }
+    dw_flush(w);
+    w->type = DELTA_COPY;
+    w->dst = dst;
+    w->src = src;
+    w->len = len;
+}
+
+/* Emit nothing, a copy from src_off (if >= 0 and identical), or a trimmed literal write */
+static void diff_chunk(DeltaWriter *w, const unsigned char *orig, size_t off, size_t n, long long src_off) {
+    const unsigned char *a = orig + off;
+    const unsigned char *b = w->out + off;
+    if (memcmp(a, b, n) == 0) return;
+    if (src_off >= 0 && memcmp(orig + src_off, b, n) == 0) {
+        dw_copy(w, off, (size_t)src_off, n);
+        return;
+    }
+    size_t first = 0, last = n;
+    while (a[first] == b[first]) first++;
+    while (a[last - 1] == b[last - 1]) last--;
+    dw_write(w, off + first, last - first);
+}
+
+int write_delta(const char *path,
+                const struct superblock *sb,
+                const unsigned char *orig,
+                const unsigned char *out,
+                size_t size,
+                const BlockMapEntry *map,
+                int map_size,
+                DeltaStats *stats) {
+    if (!path || !sb || !orig || !out || !stats || size < 1024) return -1;
+    memset(stats, 0, sizeof(*stats));
+    size_t bs = (size_t)sb->blocksize;
+    size_t data_start = 512 + 512 + (size_t)sb->data_offset * bs;
+    int total_data_blocks = sb->swap_offset - sb->data_offset;
+    if (total_data_blocks < 0) return -1;
+
+    /* new data block index -> old index it was copied from (data blocks only) */
+    int *source = (int *)malloc(sizeof(int) * (size_t)(total_data_blocks + 1));
+    if (!source) return -1;
+    for (int i = 0; i < total_data_blocks; ++i) source[i] = -1;
+    for (int m = 0; m < map_size; ++m) {
+        if (map[m].is_pointer) continue;
+        if (map[m].new_index < 0 || map[m].new_index >= total_data_blocks) continue;
+        if (map[m].old_index < 0 || map[m].old_index >= total_data_blocks) continue;
+        source[map[m].new_index] = map[m].old_index;
+    }
+
+    FILE *f = fopen(path, "wb");
+    if (!f) { free(source); return -1; }
+    DeltaWriter w = { f, out, stats, DELTA_END, 0, 0, 0, 0 };
+    if (fwrite(DELTA_MAGIC, 1, 4, f) != 4 ||
+        put_u32(f, DELTA_VERSION) != 0 ||
+        put_u64(f, (uint64_t)size) != 0 ||
+        put_u64(f, fnv1a64(orig, size)) != 0) {
+        w.err = 1;
+    }
+
+    /* Boot block and superblock, then blocksize units up to the (possibly partial) tail */
+    diff_chunk(&w, orig, 0, 512, -1);
+    diff_chunk(&w, orig, 512, 512, -1);
+    for (size_t off = 1024; off < size && !w.err; off += bs) {
+        size_t n = size - off < bs ? size - off : bs;
+        long long src_off = -1;
+        if (off >= data_start && n == bs) {
+            size_t idx = (off - data_start) / bs;
+            if (idx < (size_t)total_data_blocks && source[idx] >= 0) {
+                src_off = (long long)(data_start + (size_t)source[idx] * bs);
+            }
+        }
+        diff_chunk(&w, orig, off, n, src_off);
+    }
+    dw_flush(&w);
+    if (put_u32(f, DELTA_END) != 0 || put_u64(f, 0) != 0 || put_u64(f, 0) != 0) w.err = 1;
+    stats->patch_size = ftell(f);
+    if (fclose(f) != 0) w.err = 1;
+    free(source);
+    return w.err ? -1 : 0;
+}
+
+/* Walk every record; with img NULL only validate (bounds, payload present,
+   END record reached) without touching the image */
+static int apply_records(FILE *p, FILE *img, const unsigned char *orig, size_t size, DeltaStats *stats) {
+    unsigned char *chunk = (unsigned char *)malloc(DELTA_IO_CHUNK);
+    if (!chunk) return -1;
+    int rc = -1;
+    for (;;) {
+        uint32_t type;
+        uint64_t dst, len, src;
+        if (get_u32(p, &type) != 0 || get_u64(p, &dst) != 0 || get_u64(p, &len) != 0) break;
+        if (type == DELTA_END) { rc = 0; break; }
+        if (dst > size || len > size - dst) break;
+        if (img && fseek(img, (long)dst, SEEK_SET) != 0) break;
+        if (type == DELTA_WRITE) {
+            uint64_t left = len;
+            while (left > 0) {
+                size_t n = left < DELTA_IO_CHUNK ? (size_t)left : DELTA_IO_CHUNK;
+                if (fread(chunk, 1, n, p) != n || (img && fwrite(chunk, 1, n, img) != n)) break;
+                left -= n;
+            }
+            if (left > 0) break;
+            stats->write_records++;
+            stats->bytes_literal += (long long)len;
+        } else if (type == DELTA_COPY) {
+            if (get_u64(p, &src) != 0 || src > size || len > size - src) break;
+            if (img && fwrite(orig + src, 1, (size_t)len, img) != len) break;
+            stats->copy_records++;
+            stats->bytes_copied += (long long)len;
+        } else {
+            break;
+        }
+    }
+    free(chunk);
+    return rc;
+}
+
+int apply_delta(const char *patch_path, const char *image_path, DeltaStats *stats) {
+    if (!patch_path || !image_path || !stats) return -1;
+    memset(stats, 0, sizeof(*stats));
+    FILE *p = fopen(patch_path, "rb");
+    if (!p) return -1;
+    char magic[4];
+    uint32_t version;
+    uint64_t size, hash;
+    if (fread(magic, 1, 4, p) != 4 || memcmp(magic, DELTA_MAGIC, 4) != 0 ||
+        get_u32(p, &version) != 0 || version != DELTA_VERSION ||
+        get_u64(p, &size) != 0 || get_u64(p, &hash) != 0) {
+        fclose(p);
+        return -1;
+    }
+    /* Snapshot the original so copy sources survive earlier in-place writes */
+    unsigned char *orig = NULL;
+    size_t orig_size = 0;
+    if (load_disk_image(image_path, &orig, &orig_size) != 0) {
+        fclose(p);
+        return -1;
+    }
+    if (orig_size != size || fnv1a64(orig, orig_size) != hash) {
+        free(orig);
+        fclose(p);
+        return -1;
+    }
+    /* Validate the whole patch before the first write, so a truncated or
+       corrupt patch leaves the image untouched */
+    long records_start = ftell(p);
+    DeltaStats check;
+    memset(&check, 0, sizeof(check));
+    if (records_start < 0 || apply_records(p, NULL, orig, orig_size, &check) != 0 ||
+        fseek(p, records_start, SEEK_SET) != 0) {
+        free(orig);
+        fclose(p);
+        return -1;
+    }
+    FILE *img = fopen(image_path, "r+b");
+    if (!img) {
+        free(orig);
+        fclose(p);
+        return -1;
+    }
+    int rc = apply_records(p, img, orig, orig_size, stats);
+    stats->patch_size = ftell(p);
+    if (rc != 0) {
+        /* Write error part way: put the original back */
+        if (fseek(img, 0, SEEK_SET) == 0) fwrite(orig, 1, orig_size, img);
+    }
+    if (fclose(img) != 0) rc = -1;
+    fclose(p);
+    free(orig);
+    return rc;
+}
@@ -0,0 +1,43 @@
+#ifndef DELTA_H
+#define DELTA_H
+
+#include <stddef.h>
+#include "superblock_def.h"
+#include "block_rewrite.h"
+
+/* Patch format (all integers little-endian):
+	header:  "DFDL" u32 version, u64 image size, u64 FNV-1a hash of the original image
+	records: u32 type, u64 dst offset, u64 length, then
+	         DELTA_WRITE: length literal bytes
+	         DELTA_COPY:  u64 source offset in the original image
+	         DELTA_END:   terminates the patch (offset/length are 0) */
+#define DELTA_VERSION 1
+#define DELTA_END   0
+#define DELTA_WRITE 1
+#define DELTA_COPY  2
+
+typedef struct {
+	long long write_records;
+	long long copy_records;
+	long long bytes_literal; /* payload bytes carried in the patch */
+	long long bytes_copied;  /* bytes reproduced from the original image */
+	long long patch_size;    /* total patch file size */
+} DeltaStats;
+
+/* Diff out against orig (both size bytes) and write a patch to path.
+	map supplies old->new data block moves so relocated blocks become copies.
+	Returns 0 on success. */
+int write_delta(const char *path,
+				const struct superblock *sb,
+				const unsigned char *orig,
+				const unsigned char *out,
+				size_t size,
+				const BlockMapEntry *map,
+				int map_size,
+				DeltaStats *stats);
+
+/* Apply a patch to image_path in place. Copies read from a snapshot of the
+	original, so record order does not matter. Returns 0 on success. */
+int apply_delta(const char *patch_path, const char *image_path, DeltaStats *stats);
+
+#endif /* DELTA_H */
@@ -9,24 +9,21 @@
 /* Load entire disk image into memory */
 int load_disk_image(const char *path, unsigned char **buffer, size_t *size) {
     struct stat st;
-    if (stat(path, &st) != 0) {
-        fatal("Cannot stat input image '%s'", path);
-    }
+    if (!path || !buffer || !size) return -1;
+    if (stat(path, &st) != 0) return -1;
     size_t fsize = (size_t)st.st_size;
     FILE *f = fopen(path, "rb");
-    if (!f) {
-        fatal("Cannot open input image '%s'", path);
-    }
-    unsigned char *buf = (unsigned char *)malloc(fsize);
+    if (!f) return -1;
+    unsigned char *buf = (unsigned char *)malloc(fsize > 0 ? fsize : 1);
     if (!buf) {
         fclose(f);
-        fatal("malloc failed for %zu bytes", fsize);
+        return -1;
     }
     size_t rd = fread(buf, 1, fsize, f);
     fclose(f);
     if (rd != fsize) {
         free(buf);
-        fatal("Short read: expected %zu got %zu", fsize, rd);
+        return -1;
     }
     *buffer = buf;
     *size = fsize;
@@ -44,9 +41,7 @@ int parse_superblock(const unsigned char *buf, struct superblock *out) {
     out->free_inode   = safe_read_int_le(buf + sb_offset + 16);
     out->free_block   = safe_read_int_le(buf + sb_offset + 20);
     /* Basic sanity checks */
-    if (out->blocksize <= 0) {
-        fatal("Invalid blocksize %d", out->blocksize);
-    }
+    if (out->blocksize <= 0) return -1;
     return 0;
 }
 
@@ -11,11 +11,12 @@ int build_file_records(const unsigned char *buf,
                        const InodeView *inodes,
                        int inode_count,
                        FileRecord **out_records,
-                       int *out_count) {
+                       int *out_count,
+                       const DefragAllocator *alloc) {
     (void)buf; /* buffer may be used in future for indirect analysis */
     if (!sb || !inodes || inode_count < 0 || !out_records || !out_count) return -1;
 
-    FileRecord *recs = (FileRecord *)calloc((size_t)inode_count, sizeof(FileRecord));
+    FileRecord *recs = (FileRecord *)defrag_mem_calloc(alloc, (size_t)inode_count, sizeof(FileRecord));
     if (!recs) return -1;
 
     for (int i = 0; i < inode_count; ++i) {
@@ -87,7 +88,7 @@ int build_file_records(const unsigned char *buf,
     return 0;
 }
 
-void free_file_records(FileRecord *records, int count) {
+void free_file_records(FileRecord *records, int count, const DefragAllocator *alloc) {
     (void)count;
-    free(records);
+    defrag_mem_free(alloc, records);
 }
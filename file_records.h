@@ -4,6 +4,7 @@
 #include <stddef.h>
 #include "superblock_def.h"
 #include "inode_scan.h"
+#include "defrag_alloc.h"
 
 typedef struct {
     int inode_index;
@@ -17,14 +18,16 @@ typedef struct {
     /* Note: indirect pointers will be resolved later when rewriting */
 } FileRecord;
 
-/* Build FileRecord array from used inodes. Allocates records; caller frees via free_file_records. */
+/* Build FileRecord array from used inodes. Allocates records from alloc (NULL for the
+   C library); caller frees via free_file_records with the same allocator. */
 int build_file_records(const unsigned char *buf,
                        const struct superblock *sb,
                        const InodeView *inodes,
                        int inode_count,
                        FileRecord **out_records,
-                       int *out_count);
+                       int *out_count,
+                       const DefragAllocator *alloc);
 
-void free_file_records(FileRecord *records, int count);
+void free_file_records(FileRecord *records, int count, const DefragAllocator *alloc);
 
 #endif /* FILE_RECORDS_H */
@@ -5,23 +5,17 @@
 
 int rebuild_free_block_list(unsigned char *out_buf,
                             const struct superblock *sb,
+                            const BlockOps *ops,
                             int head_start,
                             int total_data_blocks) {
-    if (!out_buf || !sb) return -1;
+    if (!out_buf || !sb || !ops) return -1;
     if (head_start < 0 || head_start > total_data_blocks) return -1;
     size_t data_base = 512 + 512 + (size_t)sb->data_offset * (size_t)sb->blocksize;
     /* For blocks from head_start to last, set first 4 bytes to next index, rest zeros */
     for (int idx = head_start; idx < total_data_blocks; ++idx) {
-        size_t abs = data_base + (size_t)idx * (size_t)sb->blocksize;
-        unsigned char *dst = out_buf + abs;
+        size_t abs = data_base + block_ops_offset(ops, idx);
         int next = (idx + 1 < total_data_blocks) ? (idx + 1) : -1;
-        /* Write little-endian next */
-        dst[0] = (unsigned char)(next & 0xFF);
-        dst[1] = (unsigned char)((next >> 8) & 0xFF);
-        dst[2] = (unsigned char)((next >> 16) & 0xFF);
-        dst[3] = (unsigned char)((next >> 24) & 0xFF);
-        /* Zero remainder of block */
-        memset(dst + 4, 0, (size_t)sb->blocksize - 4);
+        ops->fill_free_block(out_buf + abs, next, (size_t)sb->blocksize);
     }
     return 0;
 }
@@ -2,12 +2,14 @@
 #define FREELIST_H
 
 #include "superblock_def.h"
+#include "block_ops.h"
 
 /* Rebuild ascending free block list in data region starting at head_start.
 	total_data_blocks is the number of blocks in the data region.
 	Returns 0 on success. */
 int rebuild_free_block_list(unsigned char *out_buf,
 									 const struct superblock *sb,
+									 const BlockOps *ops,
 									 int head_start,
 									 int total_data_blocks);
 
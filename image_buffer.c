@@ -0,0 +1,186 @@
+#define _GNU_SOURCE
+#include "image_buffer.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/perf_event.h>
+
+#define MPOL_INTERLEAVE_MODE 3 /* MPOL_INTERLEAVE from <linux/mempolicy.h> */
+
+/* Value of a "Key:  N kB" line in a /proc file, or -1 */
+static long long proc_kb(const char *file, const char *key) {
+    FILE *f = fopen(file, "r");
+    if (!f) return -1;
+    char line[256];
+    size_t klen = strlen(key);
+    long long v = -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, key, klen) == 0 && line[klen] == ':') {
+            v = strtoll(line + klen + 1, NULL, 10);
+            break;
+        }
+    }
+    fclose(f);
+    return v;
+}
+
+/* Memory node ids from /sys (e.g. "0-1" or "0,2"), as a bitmask; 0 if unknown */
+static unsigned long memory_nodes(void) {
+    FILE *f = fopen("/sys/devices/system/node/has_memory", "r");
+    if (!f) return 0;
+    char line[256];
+    unsigned long mask = 0;
+    if (fgets(line, sizeof(line), f)) {
+        char *p = line;
+        while (*p && *p != '\n') {
+            long lo = strtol(p, &p, 10), hi = lo;
+            if (*p == '-') hi = strtol(p + 1, &p, 10);
+            for (long n = lo; n <= hi && n < (long)(8 * sizeof(mask)); ++n) mask |= 1UL << n;
+            if (*p == ',') p++;
+            else break;
+        }
+    }
+    fclose(f);
+    return mask;
+}
+
+static size_t round_up(size_t n, size_t unit) {
+    return (n + unit - 1) / unit * unit;
+}
+
+int image_buffer_alloc(ImageBuffer *b, size_t size) {
+    if (!b) return -1;
+    memset(b, 0, sizeof(*b));
+    long long hp_kb = proc_kb("/proc/meminfo", "Hugepagesize");
+    size_t hp = hp_kb > 0 ? (size_t)hp_kb * 1024 : (size_t)2 << 20;
+    void *p = MAP_FAILED;
+
+    /* Explicit huge pages only when the pool can hold the whole buffer */
+#ifdef MAP_HUGETLB
+    long long hp_free = proc_kb("/proc/meminfo", "HugePages_Free");
+    if (size >= hp && hp_free > 0 && (size_t)hp_free * hp >= round_up(size, hp)) {
+        b->mapped = round_up(size, hp);
+        p = mmap(NULL, b->mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) b->backing = IMAGE_BUF_HUGETLB;
+    }
+#endif
+    if (p == MAP_FAILED) {
+        b->mapped = round_up(size > 0 ? size : 1, size >= hp ? hp : (size_t)sysconf(_SC_PAGESIZE));
+        p = mmap(NULL, b->mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) return -1;
+        b->backing = IMAGE_BUF_PLAIN;
+#ifdef MADV_HUGEPAGE
+        if (size >= hp && madvise(p, b->mapped, MADV_HUGEPAGE) == 0) b->backing = IMAGE_BUF_THP;
+#endif
+    }
+
+    /* Before first touch, so the policy decides where pages land */
+#ifdef SYS_mbind
+    unsigned long nodes = memory_nodes();
+    if (nodes & (nodes - 1)) {
+        b->interleaved = syscall(SYS_mbind, p, b->mapped, MPOL_INTERLEAVE_MODE, &nodes,
+                                 8 * sizeof(nodes), 0) == 0;
+    }
+#endif
+    b->data = (unsigned char *)p;
+    b->size = size;
+    return 0;
+}
+
+int image_buffer_load(ImageBuffer *b, const char *path) {
+    if (!b || !path) return -1;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || image_buffer_alloc(b, (size_t)st.st_size) != 0) {
+        close(fd);
+        return -1;
+    }
+    size_t got = 0;
+    while (got < b->size) {
+        ssize_t rd = read(fd, b->data + got, b->size - got);
+        if (rd < 0 && errno == EINTR) continue;
+        if (rd <= 0) break;
+        got += (size_t)rd;
+    }
+    close(fd);
+    if (got != b->size) {
+        image_buffer_free(b);
+        return -1;
+    }
+    return 0;
+}
+
+void image_buffer_free(ImageBuffer *b) {
+    if (!b || !b->data) return;
+    munmap(b->data, b->mapped);
+    b->data = NULL;
+}
+
+const char *image_buffer_backing_name(int backing) {
+    switch (backing) {
+    case IMAGE_BUF_THP:     return "thp";
+    case IMAGE_BUF_HUGETLB: return "hugetlb";
+    default:                return "4k";
+    }
+}
+
+void image_buffer_stats(ImageBufferStats *st) {
+    memset(st, 0, sizeof(*st));
+    long long thp = proc_kb("/proc/self/smaps_rollup", "AnonHugePages");
+    long long tlb = proc_kb("/proc/self/status", "HugetlbPages");
+    st->huge_kb = thp < 0 && tlb < 0 ? -1 : (thp > 0 ? thp : 0) + (tlb > 0 ? tlb : 0);
+
+    /* Sum the "N<node>=<pages>" fields of every mapping */
+    FILE *f = fopen("/proc/self/numa_maps", "r");
+    if (!f) return;
+    char line[4096];
+    while (fgets(line, sizeof(line), f)) {
+        for (char *p = strstr(line, " N"); p; p = strstr(p + 1, " N")) {
+            int node;
+            long long pages;
+            if (sscanf(p, " N%d=%lld", &node, &pages) == 2 && node >= 0 && node < IMAGE_BUF_MAX_NODES) {
+                st->node_pages[node] += pages;
+                if (node + 1 > st->nodes) st->nodes = node + 1;
+            }
+        }
+    }
+    fclose(f);
+}
+
+void tlb_counter_start(TlbCounter *c) {
+    c->fd = -1;
+#ifdef SYS_perf_event_open
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                  (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    c->fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    if (c->fd >= 0) {
+        ioctl(c->fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(c->fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+long long tlb_counter_stop(TlbCounter *c) {
+    if (c->fd < 0) return -1;
+    long long count = -1;
+    ioctl(c->fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (read(c->fd, &count, sizeof(count)) != (ssize_t)sizeof(count)) count = -1;
+    close(c->fd);
+    c->fd = -1;
+    return count;
+}
@@ -0,0 +1,47 @@
+#ifndef IMAGE_BUFFER_H
+#define IMAGE_BUFFER_H
+
+#include <stddef.h>
+
+/* How an ImageBuffer ended up backed */
+#define IMAGE_BUF_PLAIN    0 /* ordinary pages */
+#define IMAGE_BUF_THP      1 /* anonymous mapping advised for transparent huge pages */
+#define IMAGE_BUF_HUGETLB  2 /* explicit hugetlbfs pages (MAP_HUGETLB) */
+
+#define IMAGE_BUF_MAX_NODES 8
+
+/* Whole-image buffer: mapped in huge-page multiples so multi-GB random
+	gathers take fewer TLB misses, and interleaved across NUMA nodes when
+	there is more than one so no single node serves every access. */
+typedef struct {
+	unsigned char *data;
+	size_t size;     /* bytes requested */
+	size_t mapped;   /* bytes mapped (size rounded up to the page size used) */
+	int backing;     /* IMAGE_BUF_* */
+	int interleaved; /* 1 if pages are spread over all memory nodes */
+} ImageBuffer;
+
+/* What the kernel reports for the whole process (adjacent buffers can share
+	one mapping, so per-buffer figures would not be reliable) */
+typedef struct {
+	long long huge_kb;                         /* THP + hugetlb memory, -1 if unavailable */
+	int nodes;                                 /* entries in node_pages, 0 if unavailable */
+	long long node_pages[IMAGE_BUF_MAX_NODES]; /* resident pages per node */
+} ImageBufferStats;
+
+int image_buffer_alloc(ImageBuffer *b, size_t size);          /* 0 on success */
+int image_buffer_load(ImageBuffer *b, const char *path);      /* allocate and read a file */
+void image_buffer_free(ImageBuffer *b);
+void image_buffer_stats(ImageBufferStats *st);
+const char *image_buffer_backing_name(int backing);
+
+/* dTLB load-miss counter for the calling thread (perf_event_open); reads -1
+	if the kernel or its perf_event_paranoid setting does not allow it */
+typedef struct {
+	int fd;
+} TlbCounter;
+
+void tlb_counter_start(TlbCounter *c);
+long long tlb_counter_stop(TlbCounter *c);
+
+#endif /* IMAGE_BUFFER_H */
@@ -0,0 +1,144 @@
+#define _POSIX_C_SOURCE 200809L
+#include "indirect_walk.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Blocks ahead of the parser that memory-mode prefetches are issued for */
+#define PREFETCH_DISTANCE 8
+#define CACHE_LINE 64
+
+void block_source_memory(BlockSource *src, const unsigned char *data_region,
+                         const BlockOps *ops, int total_blocks, const DefragAllocator *alloc) {
+    memset(src, 0, sizeof(*src));
+    src->blocksize = ops->blocksize;
+    src->ops = ops;
+    src->total_blocks = total_blocks;
+    src->mem = data_region;
+    src->fd = -1;
+    src->alloc = alloc;
+}
+
+int block_source_fd(BlockSource *src, int fd, long long data_start,
+                    const BlockOps *ops, int total_blocks, const DefragAllocator *alloc) {
+    memset(src, 0, sizeof(*src));
+    src->blocksize = ops->blocksize;
+    src->ops = ops;
+    src->total_blocks = total_blocks;
+    src->fd = fd;
+    src->fd_base = data_start;
+    src->alloc = alloc;
+    src->arena = (unsigned char *)defrag_mem_alloc(alloc, block_ops_offset(ops, INDIRECT_FETCH_BATCH));
+    src->order = (BlockFetchSlot *)defrag_mem_alloc(alloc, sizeof(BlockFetchSlot) * INDIRECT_FETCH_BATCH);
+    if (!src->arena || !src->order) {
+        block_source_close(src);
+        return -1;
+    }
+    return 0;
+}
+
+void block_source_close(BlockSource *src) {
+    defrag_mem_free(src->alloc, src->arena);
+    defrag_mem_free(src->alloc, src->order);
+    src->arena = NULL;
+    src->order = NULL;
+}
+
+static void prefetch_block(const unsigned char *p, int blocksize) {
+    for (int off = 0; off < blocksize; off += CACHE_LINE) __builtin_prefetch(p + off, 0, 1);
+}
+
+static int cmp_by_block(const void *a, const void *b) {
+    int x = ((const BlockFetchSlot *)a)->block;
+    int y = ((const BlockFetchSlot *)b)->block;
+    return (x > y) - (x < y);
+}
+
+/* Make blocks[0..n) readable through out[]; out[i] is NULL for an index
+   outside the data region or a failed read */
+static void fetch_blocks(BlockSource *src, const int *blocks, int n, const unsigned char **out) {
+    if (src->mem) {
+        for (int i = 0; i < n; ++i) {
+            int b = blocks[i];
+            out[i] = (b >= 0 && b < src->total_blocks) ? src->mem + block_ops_offset(src->ops, b) : NULL;
+        }
+        return;
+    }
+    /* fd mode: read in ascending block order, one pread per run of adjacent blocks */
+    BlockFetchSlot *order = src->order;
+    for (int i = 0; i < n; ++i) {
+        order[i].block = blocks[i];
+        order[i].pos = i;
+    }
+    qsort(order, (size_t)n, sizeof(BlockFetchSlot), cmp_by_block);
+    for (int i = 0; i < n; ) {
+        int b = order[i].block;
+        if (b < 0 || b >= src->total_blocks) {
+            out[order[i++].pos] = NULL;
+            continue;
+        }
+        int j = i + 1;
+        while (j < n && order[j].block == b + (j - i)) j++;
+        /* arena slots i..j-1 receive the run */
+        size_t len = block_ops_offset(src->ops, j - i);
+        ssize_t rd = pread(src->fd, src->arena + block_ops_offset(src->ops, i), len,
+                           (off_t)(src->fd_base + (long long)block_ops_offset(src->ops, b)));
+        for (int k = i; k < j; ++k) {
+            out[order[k].pos] = rd == (ssize_t)len ? src->arena + block_ops_offset(src->ops, k) : NULL;
+        }
+        i = j;
+    }
+}
+
+int indirect_tree_resolve(BlockSource *src, const int *roots, int nroots, int levels,
+                          int limit, IndirectTree *tree) {
+    memset(tree, 0, sizeof(*tree));
+    if (!src || !roots || nroots < 0 || levels < 1 || levels > 3) return -1;
+    tree->levels = levels;
+    tree->count[0] = nroots;
+    tree->nodes[0] = (int *)defrag_mem_alloc(src->alloc, sizeof(int) * (size_t)nroots);
+    if (!tree->nodes[0]) return -1;
+    memcpy(tree->nodes[0], roots, sizeof(int) * (size_t)nroots);
+
+    int ptrs = src->blocksize / 4;
+    const unsigned char *blk[INDIRECT_FETCH_BATCH];
+    for (int l = 0; l < levels; ++l) {
+        int n = tree->count[l];
+        long long cap = (long long)n * ptrs;
+        if (cap > limit) cap = limit;
+        tree->nodes[l + 1] = (int *)defrag_mem_alloc(src->alloc, sizeof(int) * (size_t)cap);
+        tree->first[l] = (int *)defrag_mem_alloc(src->alloc, sizeof(int) * (size_t)(n + 1));
+        if (!tree->nodes[l + 1] || !tree->first[l]) return -1;
+        int cnt = 0;
+        /* Whole level is resolved before descending, a batch at a time */
+        for (int base = 0; base < n; base += INDIRECT_FETCH_BATCH) {
+            int m = n - base < INDIRECT_FETCH_BATCH ? n - base : INDIRECT_FETCH_BATCH;
+            fetch_blocks(src, tree->nodes[l] + base, m, blk);
+            for (int i = 0; i < m && i < PREFETCH_DISTANCE; ++i) {
+                if (blk[i]) prefetch_block(blk[i], src->blocksize);
+            }
+            for (int i = 0; i < m; ++i) {
+                if (i + PREFETCH_DISTANCE < m && blk[i + PREFETCH_DISTANCE]) {
+                    prefetch_block(blk[i + PREFETCH_DISTANCE], src->blocksize);
+                }
+                tree->first[l][base + i] = cnt;
+                if (!blk[i]) continue;
+                for (int k = 0; k < ptrs && cnt < cap; ++k) {
+                    int v = safe_read_int_le(blk[i] + (size_t)k * 4);
+                    if (v == -1) break;
+                    tree->nodes[l + 1][cnt++] = v;
+                }
+            }
+        }
+        tree->first[l][n] = cnt;
+        tree->count[l + 1] = cnt;
+    }
+    return 0;
+}
+
+void indirect_tree_free(IndirectTree *tree, const DefragAllocator *alloc) {
+    for (int l = 0; l < 4; ++l) defrag_mem_free(alloc, tree->nodes[l]);
+    for (int l = 0; l < 3; ++l) defrag_mem_free(alloc, tree->first[l]);
+    memset(tree, 0, sizeof(*tree));
+}
@@ -0,0 +1,56 @@
+#ifndef INDIRECT_WALK_H
+#define INDIRECT_WALK_H
+
+#include "defrag_alloc.h"
+#include "block_ops.h"
+
+/* Pointer blocks fetched and parsed together per level; bounds the fd arena */
+#define INDIRECT_FETCH_BATCH 256
+
+typedef struct {
+	int block;
+	int pos; /* index in the caller's batch */
+} BlockFetchSlot;
+
+/* Where pointer blocks are read from: the in-memory data region (software
+	prefetch ahead of parsing) or a file descriptor (each batch sorted by block
+	index and read with coalesced pread calls). */
+typedef struct {
+	int blocksize;
+	const BlockOps *ops;      /* block offsets (shift-based for power-of-two sizes) */
+	int total_blocks;         /* valid block indices are [0, total_blocks) */
+	const unsigned char *mem; /* data region in memory, or NULL for fd mode */
+	int fd;
+	long long fd_base;        /* byte offset of data block 0 in fd */
+	unsigned char *arena;     /* fd mode: INDIRECT_FETCH_BATCH blocks */
+	BlockFetchSlot *order;    /* fd mode: sort scratch */
+	const DefragAllocator *alloc;
+} BlockSource;
+
+/* One or more indirection trees of equal depth resolved breadth-first.
+	nodes[0] are the roots; nodes[l + 1] holds the children of every
+	nodes[l] block concatenated in order, with node k's children at
+	[first[l][k], first[l][k + 1]). nodes[levels] are the data blocks in
+	file order. */
+typedef struct {
+	int levels; /* 1 single, 2 double, 3 triple */
+	int *nodes[4];
+	int *first[3];
+	int count[4];
+} IndirectTree;
+
+/* ops must outlive the source */
+void block_source_memory(BlockSource *src, const unsigned char *data_region,
+						 const BlockOps *ops, int total_blocks, const DefragAllocator *alloc);
+int block_source_fd(BlockSource *src, int fd, long long data_start,
+					const BlockOps *ops, int total_blocks, const DefragAllocator *alloc); /* 0 on success */
+void block_source_close(BlockSource *src); /* releases fd-mode buffers, not the fd */
+
+/* Resolve trees under roots (-1 entries end each pointer block). At most
+	limit blocks are kept per level, which is all a file of limit data
+	blocks can reach. Returns 0 on success; release with indirect_tree_free. */
+int indirect_tree_resolve(BlockSource *src, const int *roots, int nroots, int levels,
+						  int limit, IndirectTree *tree);
+void indirect_tree_free(IndirectTree *tree, const DefragAllocator *alloc);
+
+#endif /* INDIRECT_WALK_H */
@@ -1,6 +1,9 @@
+#define _POSIX_C_SOURCE 200809L
 #include "inode_scan.h"
 #include "util.h"
+#include <pthread.h>
 #include <string.h>
+#include <unistd.h>
 
 /* Compute absolute byte offsets for regions based on superblock */
 static void compute_region_bounds(const struct superblock *sb,
@@ -14,36 +17,113 @@ static void compute_region_bounds(const struct superblock *sb,
     *swap_start  = base + (size_t)sb->swap_offset  * (size_t)sb->blocksize;
 }
 
-int scan_inodes(const unsigned char *buf, const struct superblock *sb, InodeView *array, int *count) {
-    if (!buf || !sb || !count) return -1;
-
-    size_t inode_start = 0, data_start = 0, swap_start = 0;
-    compute_region_bounds(sb, &inode_start, &data_start, &swap_start);
-
-    size_t inode_region_bytes = (data_start > inode_start) ? (data_start - inode_start) : 0;
-    if (inode_region_bytes == 0) {
-        *count = 0;
-        return 0;
-    }
+/* One thread's share of the inode array: slots [first, last) */
+typedef struct {
+    const unsigned char *inodes; /* start of the inode region */
+    int first;
+    int last;
+    int used;          /* used inodes found in the chunk */
+    InodeView *out;    /* where the chunk's views go, in index order; NULL to count */
+} ScanChunk;
 
+static void *scan_chunk(void *arg) {
+    ScanChunk *c = (ScanChunk *)arg;
     const size_t inode_size = sizeof(struct inode); /* expected 100 */
-    int capacity = (int)(inode_region_bytes / inode_size);
-    int used_count = 0;
-
-    for (int idx = 0; idx < capacity; ++idx) {
-        size_t off = inode_start + (size_t)idx * inode_size;
-        const struct inode *in = (const struct inode *)(buf + off);
+    int used = 0;
+    for (int idx = c->first; idx < c->last; ++idx) {
+        const struct inode *in = (const struct inode *)(c->inodes + (size_t)idx * inode_size);
         /* An inode is considered used if nlink > 0, per README */
         if (in->nlink > 0) {
-            if (array) {
-                array[used_count].inode_index = idx;
-                array[used_count].size_bytes = in->size;
-                array[used_count].raw = in;
+            if (c->out) {
+                c->out[used].inode_index = idx;
+                c->out[used].size_bytes = in->size;
+                c->out[used].raw = in;
             }
-            used_count++;
+            used++;
         }
     }
+    c->used = used;
+    return NULL;
+}
+
+/* Run every chunk, on threads where possible; a chunk whose thread cannot
+   be started is scanned by the caller */
+static void run_chunks(ScanChunk *chunks, int n) {
+    pthread_t threads[INODE_SCAN_MAX_THREADS];
+    int started[INODE_SCAN_MAX_THREADS];
+    for (int t = 1; t < n; ++t) {
+        started[t] = pthread_create(&threads[t], NULL, scan_chunk, &chunks[t]) == 0;
+    }
+    scan_chunk(&chunks[0]);
+    for (int t = 1; t < n; ++t) {
+        if (started[t]) pthread_join(threads[t], NULL);
+        else scan_chunk(&chunks[t]);
+    }
+}
+
+/* Split capacity slots into per-thread chunks; returns the chunk count */
+static int plan_chunks(const unsigned char *inodes, int capacity, ScanChunk *chunks) {
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int n = capacity / INODE_SCAN_MIN_CHUNK;
+    if (cpus > 0 && n > cpus) n = (int)cpus;
+    if (n > INODE_SCAN_MAX_THREADS) n = INODE_SCAN_MAX_THREADS;
+    if (n < 1) n = 1;
+    for (int t = 0; t < n; ++t) {
+        chunks[t].inodes = inodes;
+        chunks[t].first = (int)((long long)capacity * t / n);
+        chunks[t].last = (int)((long long)capacity * (t + 1) / n);
+        chunks[t].used = 0;
+        chunks[t].out = NULL;
+    }
+    return n;
+}
+
+static int inode_capacity(const struct superblock *sb, size_t *inode_start) {
+    size_t data_start = 0, swap_start = 0;
+    compute_region_bounds(sb, inode_start, &data_start, &swap_start);
+    size_t inode_region_bytes = (data_start > *inode_start) ? (data_start - *inode_start) : 0;
+    return (int)(inode_region_bytes / sizeof(struct inode));
+}
+
+/* Count per chunk, then (when out is wanted) fill each chunk's slice of
+   the array at its prefix-sum offset, so views stay in index order */
+static int scan_parallel(const unsigned char *buf, const struct superblock *sb,
+                         InodeView **array, int *count, const DefragAllocator *alloc,
+                         InodeView *caller_array) {
+    size_t inode_start = 0;
+    int capacity = inode_capacity(sb, &inode_start);
+    ScanChunk chunks[INODE_SCAN_MAX_THREADS];
+    int n = plan_chunks(buf + inode_start, capacity, chunks);
+    run_chunks(chunks, n);
 
-    *count = used_count;
+    int total = 0;
+    for (int t = 0; t < n; ++t) total += chunks[t].used;
+    *count = total;
+
+    InodeView *out = caller_array;
+    if (array) {
+        out = (InodeView *)defrag_mem_alloc(alloc, sizeof(InodeView) * (size_t)total);
+        if (!out) return -1;
+        *array = out;
+    }
+    if (!out || total == 0) return 0;
+    int offset = 0;
+    for (int t = 0; t < n; ++t) {
+        chunks[t].out = out + offset;
+        offset += chunks[t].used;
+    }
+    run_chunks(chunks, n);
     return 0;
 }
+
+int scan_inodes(const unsigned char *buf, const struct superblock *sb, InodeView *array, int *count) {
+    if (!buf || !sb || !count) return -1;
+    return scan_parallel(buf, sb, NULL, count, NULL, array);
+}
+
+int scan_inodes_alloc(const unsigned char *buf, const struct superblock *sb, InodeView **array, int *count,
+                      const DefragAllocator *alloc) {
+    if (!buf || !sb || !array || !count) return -1;
+    *array = NULL;
+    return scan_parallel(buf, sb, array, count, alloc, NULL);
+}
@@ -3,6 +3,7 @@
 
 #include <stddef.h>
 #include "superblock_def.h"
+#include "defrag_alloc.h"
 
 #define N_DBLOCKS 10
 #define N_IBLOCKS 4
@@ -29,6 +30,15 @@ typedef struct {
     const struct inode *raw;
 } InodeView;
 
+/* The inode array is split into chunks scanned by up to INODE_SCAN_MAX_THREADS
+   threads (one per online CPU, each with at least INODE_SCAN_MIN_CHUNK slots);
+   results are merged in inode index order either way. */
+#define INODE_SCAN_MAX_THREADS 32
+#define INODE_SCAN_MIN_CHUNK   65536
+
 int scan_inodes(const unsigned char *buf, const struct superblock *sb, InodeView *array, int *count); /* 0 success */
+/* Count and fill in one call; *array comes from alloc (NULL for the C library) */
+int scan_inodes_alloc(const unsigned char *buf, const struct superblock *sb, InodeView **array, int *count,
+                      const DefragAllocator *alloc);
 
 #endif /* INODE_SCAN_H */
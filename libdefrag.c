@@ -0,0 +1,346 @@
+#include "libdefrag.h"
+#include "disk_image.h"
+#include "inode_scan.h"
+#include "freelist.h"
+#include "block_ops.h"
+#include "plan_file.h"
+#include "consolidate.h"
+#include "stream_out.h"
+#include "view.h"
+#include "util.h"
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define DEFRAG_STAGE_NONE    0
+#define DEFRAG_STAGE_LOADED  1
+#define DEFRAG_STAGE_PLANNED 2
+
+struct DefragContext {
+    DefragAllocator allocator;
+    const DefragAllocator *alloc; /* &allocator, or NULL for the C library */
+    int stage;
+    const unsigned char *in_buf;
+    size_t in_size;
+    struct superblock sb;
+    BlockOps ops;
+    InodeView *views;
+    FileRecord *records;
+    int rec_count;
+    FilePlacement *placements;
+    int next_free;
+    int want_hashes;
+    long long full_moved_blocks;
+    RewriteContext rw;
+    DefragView view;
+    int view_open; /* view tables built by defrag_view_open */
+};
+
+/* Drop everything a plan stage built, back to the LOADED state */
+static void drop_plan(DefragContext *ctx) {
+    if (ctx->view_open) view_close(&ctx->view);
+    ctx->view_open = 0;
+    defrag_mem_free(ctx->alloc, ctx->rw.hashes);
+    defrag_mem_free(ctx->alloc, ctx->rw.new_of_old);
+    defrag_mem_free(ctx->alloc, ctx->rw.map);
+    defrag_mem_free(ctx->alloc, ctx->placements);
+    free_file_records(ctx->records, ctx->rec_count, ctx->alloc);
+    defrag_mem_free(ctx->alloc, ctx->views);
+    memset(&ctx->rw, 0, sizeof(ctx->rw));
+    ctx->views = NULL;
+    ctx->records = NULL;
+    ctx->rec_count = 0;
+    ctx->placements = NULL;
+    ctx->next_free = 0;
+    ctx->full_moved_blocks = 0;
+    if (ctx->stage == DEFRAG_STAGE_PLANNED) ctx->stage = DEFRAG_STAGE_LOADED;
+}
+
+/* Drop everything derived from the current input */
+static void reset_context(DefragContext *ctx) {
+    drop_plan(ctx);
+    ctx->in_buf = NULL;
+    ctx->in_size = 0;
+    ctx->stage = DEFRAG_STAGE_NONE;
+}
+
+DefragContext *defrag_create(const DefragAllocator *alloc) {
+    if (alloc && (!alloc->alloc || !alloc->resize || !alloc->release)) return NULL;
+    DefragContext *ctx = (DefragContext *)defrag_mem_calloc(alloc, 1, sizeof(DefragContext));
+    if (!ctx) return NULL;
+    if (alloc) {
+        ctx->allocator = *alloc;
+        ctx->alloc = &ctx->allocator;
+    }
+    return ctx;
+}
+
+void defrag_destroy(DefragContext *ctx) {
+    if (!ctx) return;
+    reset_context(ctx);
+    /* Free through a copy: the allocator lives inside the block being freed */
+    DefragAllocator a = ctx->allocator;
+    defrag_mem_free(ctx->alloc ? &a : NULL, ctx);
+}
+
+int defrag_load(DefragContext *ctx, const unsigned char *in, size_t size) {
+    if (!ctx || !in) return DEFRAG_ERR_INVALID;
+    reset_context(ctx);
+    if (size < 512 + 512) return DEFRAG_ERR_FORMAT;
+    struct superblock sb;
+    if (parse_superblock(in, &sb) != 0 || sb.blocksize < 8) return DEFRAG_ERR_FORMAT;
+    /* Regions must be ordered and lie inside the image */
+    if (sb.inode_offset < 0 || sb.data_offset < sb.inode_offset || sb.swap_offset < sb.data_offset ||
+        (size_t)sb.swap_offset > (size - (512 + 512)) / (size_t)sb.blocksize) {
+        return DEFRAG_ERR_FORMAT;
+    }
+    ctx->sb = sb;
+    block_ops_select(&ctx->ops, sb.blocksize);
+    ctx->in_buf = in;
+    ctx->in_size = size;
+    ctx->stage = DEFRAG_STAGE_LOADED;
+    return DEFRAG_OK;
+}
+
+static void init_rewrite(DefragContext *ctx) {
+    ctx->rw.sb = &ctx->sb;
+    ctx->rw.ops = &ctx->ops;
+    ctx->rw.alloc = ctx->alloc;
+    ctx->rw.in_buf = ctx->in_buf;
+    ctx->rw.out_buf = NULL;
+    ctx->rw.records = ctx->records;
+    ctx->rw.placements = ctx->placements;
+    ctx->rw.count = ctx->rec_count;
+}
+
+static int plan_stages(DefragContext *ctx) {
+    /* Chunked parallel scan; views come back in inode index order */
+    int used = 0;
+    if (scan_inodes_alloc(ctx->in_buf, &ctx->sb, &ctx->views, &used, ctx->alloc) != 0) return DEFRAG_ERR_NOMEM;
+
+    if (build_file_records(ctx->in_buf, &ctx->sb, ctx->views, used,
+                           &ctx->records, &ctx->rec_count, ctx->alloc) != 0) {
+        return DEFRAG_ERR_NOMEM;
+    }
+
+    /* Plan contiguous layout */
+    int place_count = 0;
+    ctx->placements = (FilePlacement *)defrag_mem_alloc(ctx->alloc, sizeof(FilePlacement) * (size_t)ctx->rec_count);
+    if (!ctx->placements) return DEFRAG_ERR_NOMEM;
+    if (plan_layout(&ctx->sb, ctx->records, ctx->rec_count, ctx->placements,
+                    &place_count, &ctx->next_free) != 0) {
+        return DEFRAG_ERR_INVALID;
+    }
+    if (ctx->next_free > ctx->sb.swap_offset - ctx->sb.data_offset) return DEFRAG_ERR_FORMAT;
+
+    init_rewrite(ctx);
+    int rc = build_block_mapping(&ctx->rw);
+    if (rc == BLOCK_MAP_ERR_RANGE) return DEFRAG_ERR_FORMAT;
+    if (rc != 0 || build_remap_table(&ctx->rw) != 0) return DEFRAG_ERR_NOMEM;
+    ctx->full_moved_blocks = count_moved_blocks(ctx->rw.map, ctx->rw.map_size);
+    return DEFRAG_OK;
+}
+
+int defrag_plan(DefragContext *ctx) {
+    if (!ctx) return DEFRAG_ERR_INVALID;
+    if (ctx->stage != DEFRAG_STAGE_LOADED) return DEFRAG_ERR_STATE;
+    int rc = plan_stages(ctx);
+    if (rc != DEFRAG_OK) {
+        drop_plan(ctx);
+        return rc;
+    }
+    ctx->stage = DEFRAG_STAGE_PLANNED;
+    return DEFRAG_OK;
+}
+
+int defrag_plan_consolidate(DefragContext *ctx) {
+    int rc = defrag_plan(ctx);
+    if (rc != DEFRAG_OK) return rc;
+    /* Start from the full layout's map: it already lists every used block */
+    ConsolidateStats cs;
+    if (consolidate_free(ctx->rw.map, ctx->rw.map_size, ctx->placements, ctx->rec_count,
+                         ctx->sb.swap_offset - ctx->sb.data_offset, &cs, ctx->alloc) != 0) {
+        drop_plan(ctx);
+        return DEFRAG_ERR_FORMAT;
+    }
+    if (build_remap_table(&ctx->rw) != 0) {
+        drop_plan(ctx);
+        return DEFRAG_ERR_NOMEM;
+    }
+    ctx->next_free = cs.used_blocks;
+    return DEFRAG_OK;
+}
+
+int defrag_load_plan(DefragContext *ctx, const char *path) {
+    if (!ctx || !path) return DEFRAG_ERR_INVALID;
+    if (ctx->stage != DEFRAG_STAGE_LOADED) return DEFRAG_ERR_STATE;
+    int rc = load_plan(path, &ctx->sb, ctx->in_buf, ctx->in_size, &ctx->records, &ctx->placements,
+                       &ctx->rec_count, &ctx->rw.map, &ctx->rw.map_size, &ctx->next_free, ctx->alloc);
+    if (rc != 0) drop_plan(ctx);
+    if (rc == PLAN_ERR_MISMATCH) return DEFRAG_ERR_PLAN_MISMATCH;
+    if (rc == PLAN_ERR_NOMEM) return DEFRAG_ERR_NOMEM;
+    if (rc != 0) return DEFRAG_ERR_PLAN;
+    init_rewrite(ctx);
+    if (build_remap_table(&ctx->rw) != 0) {
+        drop_plan(ctx);
+        return DEFRAG_ERR_PLAN;
+    }
+    ctx->stage = DEFRAG_STAGE_PLANNED;
+    return DEFRAG_OK;
+}
+
+static int alloc_hashes(DefragContext *ctx) {
+    if (!ctx->want_hashes || ctx->rw.hashes) return 0;
+    ctx->rw.hashes = (uint64_t *)defrag_mem_calloc(ctx->alloc, (size_t)ctx->rw.map_size, sizeof(uint64_t));
+    return ctx->rw.hashes ? 0 : -1;
+}
+
+int defrag_rewrite(DefragContext *ctx, unsigned char *out) {
+    if (!ctx || !out) return DEFRAG_ERR_INVALID;
+    if (ctx->stage != DEFRAG_STAGE_PLANNED) return DEFRAG_ERR_STATE;
+    const struct superblock *sb = &ctx->sb;
+    size_t base = 512 + 512;
+    size_t data_abs = base + (size_t)sb->data_offset * (size_t)sb->blocksize;
+    size_t swap_abs = base + (size_t)sb->swap_offset * (size_t)sb->blocksize;
+
+    /* Boot block, superblock and inode region as-is before rewriting selected inodes */
+    memcpy(out, ctx->in_buf, data_abs);
+    ctx->rw.out_buf = out;
+    if (alloc_hashes(ctx) != 0) return DEFRAG_ERR_NOMEM;
+    if (rewrite_inodes(&ctx->rw) != 0) return DEFRAG_ERR_INVALID;
+    if (rewrite_pointer_blocks(&ctx->rw) != 0) return DEFRAG_ERR_INVALID;
+    if (rewrite_data_blocks(&ctx->rw) != 0) return DEFRAG_ERR_NOMEM;
+
+    /* Rebuild free block list and update superblock free_block; the inode
+       free list and all other inode metadata are preserved */
+    int total_data_blocks = sb->swap_offset - sb->data_offset;
+    if (rebuild_free_block_list(out, sb, &ctx->ops, ctx->next_free, total_data_blocks) != 0) {
+        return DEFRAG_ERR_FORMAT;
+    }
+    write_int_le(out + 512 + 20, ctx->next_free);
+
+    /* Copy swap region unchanged */
+    memcpy(out + swap_abs, ctx->in_buf + swap_abs, ctx->in_size - swap_abs);
+    return DEFRAG_OK;
+}
+
+int defrag_stream(DefragContext *ctx, int out_fd) {
+    if (!ctx || out_fd < 0) return DEFRAG_ERR_INVALID;
+    if (ctx->stage != DEFRAG_STAGE_PLANNED) return DEFRAG_ERR_STATE;
+    if (alloc_hashes(ctx) != 0) return DEFRAG_ERR_NOMEM;
+    switch (stream_defragmented_image(&ctx->rw, ctx->in_size, ctx->next_free, out_fd)) {
+    case 0:                 return DEFRAG_OK;
+    case STREAM_ERR_NOMEM:  return DEFRAG_ERR_NOMEM;
+    case STREAM_ERR_FORMAT: return DEFRAG_ERR_FORMAT;
+    default:                return DEFRAG_ERR_IO;
+    }
+}
+
+int defrag_view_open(DefragContext *ctx) {
+    if (!ctx) return DEFRAG_ERR_INVALID;
+    if (ctx->stage != DEFRAG_STAGE_PLANNED) return DEFRAG_ERR_STATE;
+    if (ctx->view_open) return DEFRAG_OK;
+    int rc = view_open(&ctx->view, &ctx->rw, ctx->in_size, ctx->next_free, ctx->alloc);
+    if (rc != 0) return rc == -2 ? DEFRAG_ERR_NOMEM : DEFRAG_ERR_FORMAT;
+    ctx->view_open = 1;
+    return DEFRAG_OK;
+}
+
+int defrag_view_read(const DefragContext *ctx, size_t offset, void *buf, size_t len, size_t *got) {
+    if (!ctx || !got || (!buf && len > 0)) return DEFRAG_ERR_INVALID;
+    if (!ctx->view_open) return DEFRAG_ERR_STATE;
+    return view_read(&ctx->view, offset, (unsigned char *)buf, len, got) == 0 ? DEFRAG_OK : DEFRAG_ERR_NOMEM;
+}
+
+int defrag_set_block_hashes(DefragContext *ctx, int enable) {
+    if (!ctx) return DEFRAG_ERR_INVALID;
+    ctx->want_hashes = enable != 0;
+    return DEFRAG_OK;
+}
+
+int defrag_info(const DefragContext *ctx, DefragInfo *info) {
+    if (!ctx || !info) return DEFRAG_ERR_INVALID;
+    if (ctx->stage == DEFRAG_STAGE_NONE) return DEFRAG_ERR_STATE;
+    memset(info, 0, sizeof(*info));
+    info->sb = &ctx->sb;
+    info->kernels = ctx->ops.name;
+    info->records = ctx->records;
+    info->placements = ctx->placements;
+    info->count = ctx->rec_count;
+    info->map = ctx->rw.map;
+    info->map_size = ctx->rw.map_size;
+    info->next_free = ctx->next_free;
+    info->seek_unsorted = ctx->rw.seek_unsorted;
+    info->seek_sorted = ctx->rw.seek_sorted;
+    info->block_hashes = ctx->rw.hashes;
+    info->moved_blocks = count_moved_blocks(ctx->rw.map, ctx->rw.map_size);
+    info->full_moved_blocks = ctx->full_moved_blocks;
+    info->files_moved = count_moved_files(ctx->rw.map, ctx->rw.map_size, ctx->placements, ctx->rec_count);
+    return DEFRAG_OK;
+}
+
+int defrag_buffer(DefragContext *ctx, const unsigned char *in, size_t size, unsigned char *out) {
+    if (!ctx || !in || !out) return DEFRAG_ERR_INVALID;
+    int rc = defrag_load(ctx, in, size);
+    if (rc == DEFRAG_OK) rc = defrag_plan(ctx);
+    if (rc == DEFRAG_OK) rc = defrag_rewrite(ctx, out);
+    return rc;
+}
+
+/* Read all of fd, growing the buffer for pipes and other unsized inputs */
+static int read_all(const DefragAllocator *alloc, int fd, unsigned char **buf, size_t *size) {
+    struct stat st;
+    size_t cap = 64 * 1024;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) cap = (size_t)st.st_size;
+    unsigned char *b = (unsigned char *)defrag_mem_alloc(alloc, cap);
+    if (!b) return DEFRAG_ERR_NOMEM;
+    size_t len = 0;
+    for (;;) {
+        if (len == cap) {
+            unsigned char *nb = (unsigned char *)defrag_mem_realloc(alloc, b, cap * 2);
+            if (!nb) { defrag_mem_free(alloc, b); return DEFRAG_ERR_NOMEM; }
+            b = nb;
+            cap *= 2;
+        }
+        ssize_t rd = read(fd, b + len, cap - len);
+        if (rd < 0 && errno == EINTR) continue;
+        if (rd < 0) { defrag_mem_free(alloc, b); return DEFRAG_ERR_IO; }
+        if (rd == 0) break;
+        len += (size_t)rd;
+    }
+    *buf = b;
+    *size = len;
+    return DEFRAG_OK;
+}
+
+int defrag_fd(DefragContext *ctx, int in_fd, int out_fd) {
+    if (!ctx || in_fd < 0 || out_fd < 0) return DEFRAG_ERR_INVALID;
+    unsigned char *in = NULL;
+    size_t size = 0;
+    int rc = read_all(ctx->alloc, in_fd, &in, &size);
+    if (rc != DEFRAG_OK) return rc;
+    unsigned char *out = (unsigned char *)defrag_mem_alloc(ctx->alloc, size);
+    if (!out) rc = DEFRAG_ERR_NOMEM;
+    if (rc == DEFRAG_OK) rc = defrag_buffer(ctx, in, size, out);
+    if (rc == DEFRAG_OK && stream_write_all(out_fd, out, size) != 0) rc = DEFRAG_ERR_IO;
+    /* Records point into in, which is about to go away */
+    reset_context(ctx);
+    defrag_mem_free(ctx->alloc, out);
+    defrag_mem_free(ctx->alloc, in);
+    return rc;
+}
+
+const char *defrag_strerror(int status) {
+    switch (status) {
+    case DEFRAG_OK:                return "success";
+    case DEFRAG_ERR_INVALID:       return "invalid argument";
+    case DEFRAG_ERR_NOMEM:         return "out of memory";
+    case DEFRAG_ERR_IO:            return "I/O error";
+    case DEFRAG_ERR_FORMAT:        return "malformed disk image";
+    case DEFRAG_ERR_PLAN:          return "unreadable or inconsistent plan";
+    case DEFRAG_ERR_PLAN_MISMATCH: return "plan was built from a different image";
+    case DEFRAG_ERR_STATE:         return "defrag stage called out of order";
+    default:                       return "unknown error";
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef LIBDEFRAG_H
+#define LIBDEFRAG_H
+
+#include <stddef.h>
+#include "superblock_def.h"
+#include "defrag_alloc.h"
+#include "file_records.h"
+#include "layout_plan.h"
+#include "block_rewrite.h"
+
+/* Status codes returned by every libdefrag entry point */
+#define DEFRAG_OK                  0
+#define DEFRAG_ERR_INVALID        -1 /* bad argument */
+#define DEFRAG_ERR_NOMEM          -2 /* allocator returned NULL */
+#define DEFRAG_ERR_IO             -3 /* read/write on a file descriptor failed */
+#define DEFRAG_ERR_FORMAT         -4 /* superblock or regions inconsistent with the image */
+#define DEFRAG_ERR_PLAN           -5 /* plan file unreadable or inconsistent */
+#define DEFRAG_ERR_PLAN_MISMATCH  -6 /* plan was built from a different image */
+#define DEFRAG_ERR_STATE          -7 /* stage called before the one it depends on */
+
+typedef struct DefragContext DefragContext;
+
+/* Read-only view of a context after defrag_plan/defrag_load_plan; pointers
+	stay valid until the next stage call or defrag_destroy. */
+typedef struct {
+	const struct superblock *sb;
+	const char *kernels;            /* name of the selected block kernels */
+	const FileRecord *records;
+	const FilePlacement *placements;
+	int count;                      /* files in records/placements */
+	const BlockMapEntry *map;
+	int map_size;
+	int next_free;                  /* first free data block after the layout */
+	long long seek_unsorted;        /* gather stats, set by defrag_rewrite */
+	long long seek_sorted;
+	const uint64_t *block_hashes;   /* per map entry when enabled, else NULL */
+	long long moved_blocks;         /* blocks the plan relocates */
+	long long full_moved_blocks;    /* blocks a full defrag of this image relocates */
+	int files_moved;                /* files with at least one relocated block */
+} DefragInfo;
+
+/* Create a context; alloc may be NULL for the C library. The allocator is
+	copied and used for the context and every pipeline allocation. */
+DefragContext *defrag_create(const DefragAllocator *alloc);
+void defrag_destroy(DefragContext *ctx);
+
+/* One-shot: defragment in (size bytes) into out (size bytes, may not alias in) */
+int defrag_buffer(DefragContext *ctx, const unsigned char *in, size_t size, unsigned char *out);
+/* One-shot: read an image from in_fd, write the defragmented image to out_fd */
+int defrag_fd(DefragContext *ctx, int in_fd, int out_fd);
+
+/* Staged use. in must stay alive and unmodified until the context is
+	reset or destroyed: records point into its inode region. */
+int defrag_load(DefragContext *ctx, const unsigned char *in, size_t size);
+int defrag_plan(DefragContext *ctx);                       /* scan, layout, block map */
+int defrag_plan_consolidate(DefragContext *ctx);           /* minimal moves for one free tail */
+int defrag_load_plan(DefragContext *ctx, const char *path); /* instead of defrag_plan */
+int defrag_rewrite(DefragContext *ctx, unsigned char *out); /* materialize the image */
+/* Instead of defrag_rewrite: write the image to out_fd strictly sequentially
+	(pipes, compressors) with bounded buffering; no seek statistics */
+int defrag_stream(DefragContext *ctx, int out_fd);
+/* Or read the defragmented image by offset without materializing it: open
+	builds per-block and per-inode lookup tables after planning; reads then
+	synthesize the requested bytes and may run concurrently. *got is short
+	only past the end of the image. */
+int defrag_view_open(DefragContext *ctx);
+int defrag_view_read(const DefragContext *ctx, size_t offset, void *buf, size_t len, size_t *got);
+/* Hash each data block (block_hash) while defrag_rewrite/defrag_stream copies it */
+int defrag_set_block_hashes(DefragContext *ctx, int enable);
+int defrag_info(const DefragContext *ctx, DefragInfo *info);
+
+const char *defrag_strerror(int status);
+
+#endif /* LIBDEFRAG_H */
@@ -0,0 +1,230 @@
+#define _POSIX_C_SOURCE 200809L
+#include "manifest.h"
+#include "block_hash.h"
+#include "disk_image.h"
+#include "inode_scan.h"
+#include "indirect_walk.h"
+#include "util.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+    int inode_index;
+    int logical_block;
+    uint64_t hash;
+} ManifestEntry;
+
+static int put_u32(FILE *f, uint32_t v) {
+    unsigned char b[4];
+    write_int_le(b, (int)v);
+    return fwrite(b, 1, 4, f) == 4 ? 0 : -1;
+}
+
+int write_manifest(const char *path,
+                   const struct superblock *sb,
+                   const FilePlacement *placements,
+                   int count,
+                   const BlockMapEntry *map,
+                   int map_size,
+                   const uint64_t *hashes) {
+    if (!path || !sb || (count > 0 && !placements) || (map_size > 0 && (!map || !hashes))) return -1;
+    uint32_t entries = 0;
+    for (int m = 0; m < map_size; ++m) if (!map[m].is_pointer) entries++;
+
+    FILE *f = fopen(path, "wb");
+    if (!f) return -1;
+    int ok = fwrite("DFRGMANI", 1, 8, f) == 8 &&
+             put_u32(f, MANIFEST_VERSION) == 0 &&
+             put_u32(f, (uint32_t)sb->blocksize) == 0 &&
+             put_u32(f, entries) == 0;
+    /* The map lists files in placement order, each with pointer + data
+       block entries (wherever the planner put them) */
+    int file = 0, logical = 0, left = count > 0 ? placements[0].pointer_block_count + placements[0].data_block_count : 0;
+    for (int m = 0; m < map_size && ok; ++m) {
+        while (file < count && left == 0) {
+            file++;
+            logical = 0;
+            if (file < count) left = placements[file].pointer_block_count + placements[file].data_block_count;
+        }
+        left--;
+        if (file == count) { ok = 0; break; }
+        if (map[m].is_pointer) continue;
+        unsigned char rec[16];
+        write_int_le(rec, placements[file].inode_index);
+        write_int_le(rec + 4, logical++);
+        for (int i = 0; i < 8; ++i) rec[8 + i] = (unsigned char)((hashes[m] >> (8 * i)) & 0xFF);
+        ok = fwrite(rec, 1, sizeof(rec), f) == sizeof(rec);
+    }
+    if (fclose(f) != 0) ok = 0;
+    return ok ? 0 : -1;
+}
+
+static int read_manifest(const char *path, int *blocksize, ManifestEntry **out, long long *count) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return -1;
+    unsigned char hdr[20];
+    if (fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr) || memcmp(hdr, "DFRGMANI", 8) != 0 ||
+        safe_read_int_le(hdr + 8) != MANIFEST_VERSION) {
+        fclose(f);
+        return -1;
+    }
+    *blocksize = safe_read_int_le(hdr + 12);
+    uint32_t n = (uint32_t)safe_read_int_le(hdr + 16);
+    ManifestEntry *e = (ManifestEntry *)malloc(sizeof(ManifestEntry) * (n > 0 ? n : 1));
+    if (!e) { fclose(f); return -1; }
+    for (uint32_t i = 0; i < n; ++i) {
+        unsigned char rec[16];
+        if (fread(rec, 1, sizeof(rec), f) != sizeof(rec)) { free(e); fclose(f); return -1; }
+        e[i].inode_index = safe_read_int_le(rec);
+        e[i].logical_block = safe_read_int_le(rec + 4);
+        e[i].hash = 0;
+        for (int k = 7; k >= 0; --k) e[i].hash = (e[i].hash << 8) | rec[8 + k];
+    }
+    fclose(f);
+    *out = e;
+    *count = n;
+    return 0;
+}
+
+/* Per-image state for one checker thread; reads go through pread on fd */
+typedef struct {
+    const char *path;
+    const ManifestEntry *entries;
+    long long count;
+    int blocksize;
+    int fd;
+    struct superblock sb;
+    int total_data_blocks;
+    BlockOps ops;
+    BlockSource src; /* pointer blocks, read in sorted batches */
+    ManifestImageResult result;
+} ImageChecker;
+
+static int read_data_block(ImageChecker *c, int idx, unsigned char *buf) {
+    if (idx < 0 || idx >= c->total_data_blocks) return -1;
+    off_t off = (off_t)(512 + 512) + ((off_t)c->sb.data_offset + idx) * c->sb.blocksize;
+    return pread(c->fd, buf, (size_t)c->sb.blocksize, off) == (ssize_t)c->sb.blocksize ? 0 : -1;
+}
+
+/* Append the data blocks under roots (resolved level by level) to list */
+static int append_indirect(ImageChecker *c, const int *roots, int nroots, int levels,
+                           int *list, int *n, int total) {
+    IndirectTree tree;
+    int rc = indirect_tree_resolve(&c->src, roots, nroots, levels, total - *n, &tree);
+    if (rc == 0) {
+        memcpy(list + *n, tree.nodes[levels], sizeof(int) * (size_t)tree.count[levels]);
+        *n += tree.count[levels];
+    }
+    indirect_tree_free(&tree, NULL);
+    return rc;
+}
+
+/* Logical -> physical data blocks for one inode, in file order */
+static int collect_blocks(ImageChecker *c, const struct inode *in, int *list, int total) {
+    int n = 0;
+    for (int j = 0; j < N_DBLOCKS && n < total; ++j) list[n++] = in->dblocks[j];
+    if (n < total) {
+        int nsingles = 0;
+        while (nsingles < N_IBLOCKS && in->iblocks[nsingles] != -1) nsingles++;
+        if (append_indirect(c, in->iblocks, nsingles, 1, list, &n, total) != 0) return -1;
+    }
+    if (n < total && in->i2block != -1 && append_indirect(c, &in->i2block, 1, 2, list, &n, total) != 0) return -1;
+    if (n < total && in->i3block != -1 && append_indirect(c, &in->i3block, 1, 3, list, &n, total) != 0) return -1;
+    return n;
+}
+
+static void *check_image(void *arg) {
+    ImageChecker *c = (ImageChecker *)arg;
+    unsigned char head[1024];
+    c->fd = open(c->path, O_RDONLY);
+    if (c->fd < 0 || pread(c->fd, head, sizeof(head), 0) != (ssize_t)sizeof(head) ||
+        parse_superblock(head, &c->sb) != 0 || c->sb.blocksize != c->blocksize) {
+        c->result.error = 1;
+        if (c->fd >= 0) close(c->fd);
+        return NULL;
+    }
+    c->total_data_blocks = c->sb.swap_offset - c->sb.data_offset;
+    block_ops_select(&c->ops, c->sb.blocksize);
+    size_t bs = (size_t)c->sb.blocksize;
+    size_t inode_bytes = (size_t)(c->sb.data_offset - c->sb.inode_offset) * bs;
+    unsigned char *inodes = (unsigned char *)malloc(inode_bytes > 0 ? inode_bytes : 1);
+    unsigned char *block = (unsigned char *)malloc(bs);
+    int *list = NULL;
+    if (!inodes || !block ||
+        pread(c->fd, inodes, inode_bytes, (off_t)(512 + 512) + (off_t)c->sb.inode_offset * (off_t)bs) != (ssize_t)inode_bytes ||
+        block_source_fd(&c->src, c->fd, (long long)(512 + 512) + (long long)c->sb.data_offset * (long long)bs,
+                        &c->ops, c->total_data_blocks, NULL) != 0) {
+        c->result.error = 1;
+    }
+    int capacity = (int)(inode_bytes / sizeof(struct inode));
+
+    for (long long i = 0; i < c->count && !c->result.error; ) {
+        /* Entries for one inode are contiguous */
+        long long j = i;
+        while (j < c->count && c->entries[j].inode_index == c->entries[i].inode_index) j++;
+        int ino = c->entries[i].inode_index;
+        int have = -1;
+        if (ino >= 0 && ino < capacity) {
+            const struct inode *in = (const struct inode *)(inodes + (size_t)ino * sizeof(struct inode));
+            int total = in->nlink > 0 ? (int)(((long long)in->size + (long long)bs - 1) / (long long)bs) : 0;
+            int *nl = (int *)realloc(list, sizeof(int) * (size_t)(total > 0 ? total : 1));
+            if (!nl) { c->result.error = 1; break; }
+            list = nl;
+            have = collect_blocks(c, in, list, total);
+        }
+        for (long long k = i; k < j; ++k) {
+            int lb = c->entries[k].logical_block;
+            if (have < 0 || lb < 0 || lb >= have || read_data_block(c, list[lb], block) != 0) {
+                c->result.missing++;
+                continue;
+            }
+            c->result.checked++;
+            if (block_hash(block, bs) != c->entries[k].hash) c->result.mismatched++;
+        }
+        i = j;
+    }
+    block_source_close(&c->src);
+    free(list);
+    free(block);
+    free(inodes);
+    close(c->fd);
+    return NULL;
+}
+
+int check_manifest(const char *manifest_path,
+                   const char *source_path,
+                   const char *output_path,
+                   ManifestCheck *result) {
+    if (!manifest_path || !source_path || !output_path || !result) return -1;
+    memset(result, 0, sizeof(*result));
+    ManifestEntry *entries = NULL;
+    long long count = 0;
+    int blocksize = 0;
+    if (read_manifest(manifest_path, &blocksize, &entries, &count) != 0) return -1;
+    result->entries = count;
+
+    ImageChecker checkers[2];
+    memset(checkers, 0, sizeof(checkers));
+    const char *paths[2] = { source_path, output_path };
+    pthread_t threads[2];
+    int started[2] = { 0, 0 };
+    for (int t = 0; t < 2; ++t) {
+        checkers[t].path = paths[t];
+        checkers[t].entries = entries;
+        checkers[t].count = count;
+        checkers[t].blocksize = blocksize;
+        started[t] = pthread_create(&threads[t], NULL, check_image, &checkers[t]) == 0;
+        if (!started[t]) check_image(&checkers[t]); /* fall back to running inline */
+    }
+    for (int t = 0; t < 2; ++t) {
+        if (started[t]) pthread_join(threads[t], NULL);
+    }
+    result->source = checkers[0].result;
+    result->output = checkers[1].result;
+    free(entries);
+    return 0;
+}
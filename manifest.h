@@ -0,0 +1,48 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+#include <stdint.h>
+#include "superblock_def.h"
+#include "layout_plan.h"
+#include "block_rewrite.h"
+
+/* Manifest format (little-endian):
+	header:  "DFRGMANI" u32 version, u32 blocksize, u32 entry count
+	entries: u32 inode, u32 logical block, u64 block_hash of the block contents
+	Entries are ordered by inode, then logical block. */
+#define MANIFEST_VERSION 1
+
+typedef struct {
+	long long checked;    /* blocks hashed and compared */
+	long long mismatched; /* blocks whose hash differs from the manifest */
+	long long missing;    /* manifest blocks the image's inode does not reach */
+	int error;            /* nonzero if the image could not be read */
+} ManifestImageResult;
+
+typedef struct {
+	long long entries;
+	ManifestImageResult source;
+	ManifestImageResult output;
+} ManifestCheck;
+
+/* Write one entry per mapped data block. hashes is indexed like map (as
+	filled by rewrite_data_blocks); placements give each block's file.
+	Returns 0 on success. */
+int write_manifest(const char *path,
+				   const struct superblock *sb,
+				   const FilePlacement *placements,
+				   int count,
+				   const BlockMapEntry *map,
+				   int map_size,
+				   const uint64_t *hashes);
+
+/* Re-hash every manifest block in both images, each resolved through its
+	own inodes and pointer blocks. The images are checked concurrently and
+	read one block at a time. Returns 0 if the check ran (see result for
+	mismatches), -1 if the manifest could not be read. */
+int check_manifest(const char *manifest_path,
+				   const char *source_path,
+				   const char *output_path,
+				   ManifestCheck *result);
+
+#endif /* MANIFEST_H */
@@ -0,0 +1,246 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "inode_scan.h"
+#include "util.h"
+
+/* Synthetic fragmented images for training and checking the release build.
+   Every image is fully shuffled: data and pointer blocks come from a random
+   permutation of the data region, used inodes are scattered over the inode
+   array, and the free inode and block lists are in random order. */
+
+typedef struct {
+    const char *name;
+    int blocksize;
+    int inodes;          /* inode slots */
+    int small_files;     /* files of 0..small_max bytes */
+    int small_max;
+    int large[4];        /* sizes of large files in blocks, 0-terminated */
+    int free_blocks;
+    uint64_t seed;
+} CorpusSpec;
+
+/* Small/large files at every indirection depth, power-of-two and generic blocksizes */
+static const CorpusSpec corpus[] = {
+    { "small_512",    512,  4096, 1500, 512 * 9,   { 0 },           200, 1 },
+    { "single_1024",  1024, 2048, 300,  1024 * 20, { 200, 600, 0 }, 300, 2 },
+    { "double_2048",  2048, 512,  100,  2048 * 12, { 3000, 1200, 0 }, 100, 3 },
+    { "triple_512",   512,  256,  50,   512 * 30,  { 20000, 0 },    100, 4 },
+    { "double_4096",  4096, 256,  50,   4096 * 16, { 6000, 0 },     50, 5 },
+    { "generic_1000", 1000, 512,  100,  1000 * 25, { 1500, 0 },     50, 6 },
+    /* Large enough (about 260 MB) that the copy and remap loops dominate a run */
+    { "large_1024",   1024, 64,   20,   1024 * 30, { 200000, 60000, 0 }, 200, 7 },
+};
+
+typedef struct {
+    uint64_t state;
+} Rng;
+
+static uint64_t rng_next(Rng *r) {
+    /* xorshift64* */
+    r->state ^= r->state >> 12;
+    r->state ^= r->state << 25;
+    r->state ^= r->state >> 27;
+    return r->state * 2685821657736338717ULL;
+}
+
+static int rng_below(Rng *r, int n) {
+    return (int)(rng_next(r) % (uint64_t)n);
+}
+
+static void fill_random(Rng *r, unsigned char *p, size_t n) {
+    for (size_t i = 0; i < n; ++i) p[i] = (unsigned char)(rng_next(r) >> 56);
+}
+
+static void shuffle(Rng *r, int *a, int n) {
+    for (int i = n - 1; i > 0; --i) {
+        int j = rng_below(r, i + 1);
+        int t = a[i];
+        a[i] = a[j];
+        a[j] = t;
+    }
+}
+
+/* Pointer blocks a file of nb data blocks needs */
+static int pointer_blocks(int nb, int ppb) {
+    int rem = nb > N_DBLOCKS ? nb - N_DBLOCKS : 0;
+    int ptr = 0;
+    for (int k = 0; k < N_IBLOCKS && rem > 0; ++k) {
+        ptr++;
+        rem -= rem < ppb ? rem : ppb;
+    }
+    if (rem > 0) {
+        int used = rem < ppb * ppb ? rem : ppb * ppb;
+        ptr += 1 + (used + ppb - 1) / ppb;
+        rem -= used;
+    }
+    if (rem > 0) {
+        int pp = ppb * ppb;
+        ptr += 1 + (rem + pp - 1) / pp + (rem + ppb - 1) / ppb;
+    }
+    return ptr;
+}
+
+typedef struct {
+    unsigned char *img;
+    size_t data_base;
+    int bs;
+    int ppb;
+    int *pool;      /* unused data blocks, popped from the end */
+    int pool_len;
+    const int *data; /* the current file's data blocks beyond the direct ones */
+    int left;
+} Builder;
+
+static unsigned char *block_at(Builder *b, int idx) {
+    return b->img + b->data_base + (size_t)idx * (size_t)b->bs;
+}
+
+static int new_pointer_block(Builder *b) {
+    int blk = b->pool[--b->pool_len];
+    for (int q = 0; q < b->ppb; ++q) write_int_le(block_at(b, blk) + q * 4, -1);
+    return blk;
+}
+
+static int fill_single(Builder *b) {
+    int s = new_pointer_block(b);
+    for (int q = 0; q < b->ppb && b->left > 0; ++q, --b->left) {
+        write_int_le(block_at(b, s) + q * 4, *b->data++);
+    }
+    return s;
+}
+
+static int fill_double(Builder *b) {
+    int d = new_pointer_block(b);
+    for (int q = 0; q < b->ppb && b->left > 0; ++q) write_int_le(block_at(b, d) + q * 4, fill_single(b));
+    return d;
+}
+
+static int fill_triple(Builder *b) {
+    int t = new_pointer_block(b);
+    for (int q = 0; q < b->ppb && b->left > 0; ++q) write_int_le(block_at(b, t) + q * 4, fill_double(b));
+    return t;
+}
+
+static int build_image(const CorpusSpec *spec, const char *path) {
+    Rng rng = { spec->seed * 0x9E3779B97F4A7C15ULL + 1 };
+    int bs = spec->blocksize;
+    int ppb = bs / 4;
+    int nfiles = spec->small_files;
+    while (nfiles - spec->small_files < 4 && spec->large[nfiles - spec->small_files] > 0) nfiles++;
+    if (nfiles > spec->inodes) return -1;
+
+    int *sizes = (int *)malloc(sizeof(int) * (size_t)(nfiles > 0 ? nfiles : 1));
+    if (!sizes) return -1;
+    int ndata = spec->free_blocks;
+    for (int i = 0; i < nfiles; ++i) {
+        if (i < spec->small_files) sizes[i] = rng_below(&rng, spec->small_max + 1);
+        else sizes[i] = spec->large[i - spec->small_files] * bs - rng_below(&rng, bs);
+        int nb = (sizes[i] + bs - 1) / bs;
+        ndata += nb + pointer_blocks(nb, ppb);
+    }
+    shuffle(&rng, sizes, nfiles);
+
+    int inode_blocks = (int)(((size_t)spec->inodes * sizeof(struct inode) + (size_t)bs - 1) / (size_t)bs);
+    int swap_blocks = 3;
+    size_t total = 1024 + (size_t)(inode_blocks + ndata + swap_blocks) * (size_t)bs;
+    unsigned char *img = (unsigned char *)calloc(total, 1);
+    int *pool = (int *)malloc(sizeof(int) * (size_t)ndata);
+    int *slots = (int *)malloc(sizeof(int) * (size_t)spec->inodes);
+    int *blocks = (int *)malloc(sizeof(int) * (size_t)ndata);
+    char *used = (char *)calloc((size_t)spec->inodes, 1);
+    int rc = -1;
+    if (!img || !pool || !slots || !blocks || !used) goto out;
+
+    fill_random(&rng, img, 512);
+    for (int i = 0; i < ndata; ++i) pool[i] = i;
+    shuffle(&rng, pool, ndata);
+    for (int i = 0; i < spec->inodes; ++i) slots[i] = i;
+    shuffle(&rng, slots, spec->inodes);
+    for (int i = 0; i < nfiles; ++i) used[slots[i]] = 1;
+
+    Builder b = { img, 1024 + (size_t)inode_blocks * (size_t)bs, bs, ppb, pool, ndata, NULL, 0 };
+    size_t inode_base = 1024;
+    int f = 0;
+    for (int slot = 0; slot < spec->inodes; ++slot) {
+        if (!used[slot]) continue;
+        int size = sizes[f++];
+        int nb = (size + bs - 1) / bs;
+        for (int k = 0; k < nb; ++k) {
+            blocks[k] = pool[--b.pool_len];
+            size_t n = (size_t)(size - k * bs < bs ? size - k * bs : bs);
+            fill_random(&rng, block_at(&b, blocks[k]), n);
+        }
+        struct inode ino;
+        memset(&ino, 0, sizeof(ino));
+        ino.nlink = 1;
+        ino.size = size;
+        ino.uid = 1000;
+        ino.gid = 100;
+        ino.ctime = 7;
+        ino.mtime = 8;
+        ino.atime = 9;
+        for (int j = 0; j < N_DBLOCKS; ++j) ino.dblocks[j] = j < nb ? blocks[j] : -1;
+        for (int j = 0; j < N_IBLOCKS; ++j) ino.iblocks[j] = -1;
+        ino.i2block = -1;
+        ino.i3block = -1;
+        b.data = blocks + N_DBLOCKS;
+        b.left = nb > N_DBLOCKS ? nb - N_DBLOCKS : 0;
+        for (int j = 0; j < N_IBLOCKS && b.left > 0; ++j) ino.iblocks[j] = fill_single(&b);
+        if (b.left > 0) ino.i2block = fill_double(&b);
+        if (b.left > 0) ino.i3block = fill_triple(&b);
+        int *fields = &ino.next_inode;
+        for (size_t k = 0; k < sizeof(ino) / sizeof(int); ++k) {
+            write_int_le(img + inode_base + (size_t)slot * sizeof(struct inode) + k * 4, fields[k]);
+        }
+    }
+
+    /* Free inodes and blocks, each chained in random order */
+    int nfree_inodes = 0;
+    for (int i = 0; i < spec->inodes; ++i) {
+        if (!used[slots[i]]) slots[nfree_inodes++] = slots[i];
+    }
+    for (int k = 0; k < nfree_inodes; ++k) {
+        unsigned char *p = img + inode_base + (size_t)slots[k] * sizeof(struct inode);
+        write_int_le(p, k + 1 < nfree_inodes ? slots[k + 1] : -1);
+        for (int j = 9; j < 25; ++j) write_int_le(p + j * 4, -1);
+    }
+    for (int k = 0; k < b.pool_len; ++k) {
+        write_int_le(block_at(&b, pool[k]), k + 1 < b.pool_len ? pool[k + 1] : -1);
+    }
+    size_t swap_abs = 1024 + (size_t)(inode_blocks + ndata) * (size_t)bs;
+    fill_random(&rng, img + swap_abs, total - swap_abs);
+
+    int sbv[6] = { bs, 0, inode_blocks, inode_blocks + ndata,
+                   nfree_inodes > 0 ? slots[0] : -1, b.pool_len > 0 ? pool[0] : -1 };
+    for (int k = 0; k < 6; ++k) write_int_le(img + 512 + k * 4, sbv[k]);
+
+    FILE *out = fopen(path, "wb");
+    if (out) {
+        rc = fwrite(img, 1, total, out) == total ? 0 : -1;
+        if (fclose(out) != 0) rc = -1;
+    }
+out:
+    free(used);
+    free(blocks);
+    free(slots);
+    free(pool);
+    free(img);
+    free(sizes);
+    return rc;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <output_dir>\n", argv[0]);
+        return 1;
+    }
+    for (size_t i = 0; i < sizeof(corpus) / sizeof(corpus[0]); ++i) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", argv[1], corpus[i].name);
+        if (build_image(&corpus[i], path) != 0) fatal("Cannot write corpus image '%s'", path);
+        printf("%s\n", path);
+    }
+    return 0;
+}
@@ -0,0 +1,196 @@
+#include "plan_file.h"
+#include "util.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Superblock through the end of the inode region: what planning depends on */
+static uint64_t source_checksum(const struct superblock *sb, const unsigned char *in_buf, size_t in_size) {
+    size_t data_start = 512 + 512 + (size_t)sb->data_offset * (size_t)sb->blocksize;
+    if (data_start > in_size) data_start = in_size;
+    return fnv1a64(in_buf + 512, data_start - 512);
+}
+
+int save_plan(const char *path,
+              const struct superblock *sb,
+              const unsigned char *in_buf,
+              size_t in_size,
+              const FilePlacement *placements,
+              int count,
+              const BlockMapEntry *map,
+              int map_size,
+              int next_free) {
+    if (!path || !sb || !in_buf || (count > 0 && !placements) || (map_size > 0 && !map)) return -1;
+
+    /* Coalesce map entries into runs where old and new both advance by one */
+    PlanExtent *extents = (PlanExtent *)malloc(sizeof(PlanExtent) * (size_t)(map_size > 0 ? map_size : 1));
+    if (!extents) return -1;
+    int extent_count = 0;
+    for (int m = 0; m < map_size; ++m) {
+        PlanExtent *last = extent_count > 0 ? &extents[extent_count - 1] : NULL;
+        if (last && last->is_pointer == map[m].is_pointer &&
+            last->old_start + last->length == map[m].old_index &&
+            last->new_start + last->length == map[m].new_index) {
+            last->length++;
+            continue;
+        }
+        extents[extent_count].old_start = map[m].old_index;
+        extents[extent_count].new_start = map[m].new_index;
+        extents[extent_count].length = 1;
+        extents[extent_count].is_pointer = map[m].is_pointer;
+        extent_count++;
+    }
+
+    PlanHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, PLAN_MAGIC, sizeof(hdr.magic));
+    hdr.version = PLAN_VERSION;
+    hdr.blocksize = (uint32_t)sb->blocksize;
+    hdr.image_size = (uint64_t)in_size;
+    hdr.source_checksum = source_checksum(sb, in_buf, in_size);
+    hdr.file_count = count;
+    hdr.extent_count = extent_count;
+    hdr.next_free = next_free;
+
+    FILE *f = fopen(path, "wb");
+    if (!f) { free(extents); return -1; }
+    int ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+    for (int i = 0; i < count && ok; ++i) {
+        PlanFile pf = {
+            placements[i].inode_index,
+            placements[i].start_block,
+            placements[i].pointer_block_count,
+            placements[i].data_block_count
+        };
+        ok = fwrite(&pf, sizeof(pf), 1, f) == 1;
+    }
+    if (ok && extent_count > 0) {
+        ok = fwrite(extents, sizeof(PlanExtent), (size_t)extent_count, f) == (size_t)extent_count;
+    }
+    if (fclose(f) != 0) ok = 0;
+    free(extents);
+    return ok ? 0 : -1;
+}
+
+/* Expand a validated mapping into records, placements and block map */
+static int expand_plan(const PlanHeader *hdr,
+                       const struct superblock *sb,
+                       const unsigned char *in_buf,
+                       FileRecord **records,
+                       FilePlacement **placements,
+                       BlockMapEntry **map,
+                       int *map_size,
+                       const DefragAllocator *alloc) {
+    const PlanFile *files = (const PlanFile *)(hdr + 1);
+    const PlanExtent *extents = (const PlanExtent *)(files + hdr->file_count);
+    int total_data_blocks = sb->swap_offset - sb->data_offset;
+    int inode_capacity = (int)((size_t)(sb->data_offset - sb->inode_offset) * (size_t)sb->blocksize
+                               / sizeof(struct inode));
+    size_t inode_start = 512 + 512 + (size_t)sb->inode_offset * (size_t)sb->blocksize;
+
+    long long entries = 0;
+    for (int e = 0; e < hdr->extent_count; ++e) {
+        const PlanExtent *x = &extents[e];
+        if (x->length <= 0 || x->old_start < 0 || x->new_start < 0 ||
+            x->old_start > total_data_blocks - x->length ||
+            x->new_start > total_data_blocks - x->length) {
+            return PLAN_ERR_FORMAT;
+        }
+        entries += x->length;
+    }
+    if (entries > total_data_blocks) return PLAN_ERR_FORMAT;
+
+    FileRecord *recs = (FileRecord *)defrag_mem_calloc(alloc, (size_t)hdr->file_count, sizeof(FileRecord));
+    FilePlacement *pl = (FilePlacement *)defrag_mem_alloc(alloc, sizeof(FilePlacement) * (size_t)hdr->file_count);
+    BlockMapEntry *m = (BlockMapEntry *)defrag_mem_alloc(alloc, sizeof(BlockMapEntry) * (size_t)entries);
+    if (!recs || !pl || !m) {
+        defrag_mem_free(alloc, recs); defrag_mem_free(alloc, pl); defrag_mem_free(alloc, m);
+        return PLAN_ERR_NOMEM;
+    }
+    for (int i = 0; i < hdr->file_count; ++i) {
+        const PlanFile *pf = &files[i];
+        if (pf->inode_index < 0 || pf->inode_index >= inode_capacity) {
+            defrag_mem_free(alloc, recs); defrag_mem_free(alloc, pl); defrag_mem_free(alloc, m);
+            return PLAN_ERR_FORMAT;
+        }
+        pl[i].inode_index = pf->inode_index;
+        pl[i].start_block = pf->start_block;
+        pl[i].pointer_block_count = pf->pointer_block_count;
+        pl[i].data_block_count = pf->data_block_count;
+        FileRecord *fr = &recs[i];
+        fr->inode_index = pf->inode_index;
+        fr->raw = (const struct inode *)(in_buf + inode_start + (size_t)pf->inode_index * sizeof(struct inode));
+        fr->size_bytes = fr->raw->size;
+        fr->data_block_count = pf->data_block_count;
+        fr->pointer_blocks_count = pf->pointer_block_count;
+        fr->direct_count = pf->data_block_count < N_DBLOCKS ? pf->data_block_count : N_DBLOCKS;
+        for (int j = 0; j < fr->direct_count; ++j) fr->direct_blocks[j] = fr->raw->dblocks[j];
+    }
+    int n = 0;
+    for (int e = 0; e < hdr->extent_count; ++e) {
+        for (int k = 0; k < extents[e].length; ++k) {
+            m[n].old_index = extents[e].old_start + k;
+            m[n].new_index = extents[e].new_start + k;
+            m[n].is_pointer = extents[e].is_pointer;
+            n++;
+        }
+    }
+    *records = recs;
+    *placements = pl;
+    *map = m;
+    *map_size = n;
+    return 0;
+}
+
+int load_plan(const char *path,
+              const struct superblock *sb,
+              const unsigned char *in_buf,
+              size_t in_size,
+              FileRecord **records,
+              FilePlacement **placements,
+              int *count,
+              BlockMapEntry **map,
+              int *map_size,
+              int *next_free,
+              const DefragAllocator *alloc) {
+    if (!path || !sb || !in_buf || !records || !placements || !count || !map || !map_size || !next_free) {
+        return PLAN_ERR_FORMAT;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return PLAN_ERR_FORMAT;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(PlanHeader)) {
+        close(fd);
+        return PLAN_ERR_FORMAT;
+    }
+    size_t plan_size = (size_t)st.st_size;
+    void *base = mmap(NULL, plan_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return PLAN_ERR_FORMAT;
+
+    const PlanHeader *hdr = (const PlanHeader *)base;
+    int rc = 0;
+    if (memcmp(hdr->magic, PLAN_MAGIC, sizeof(hdr->magic)) != 0 || hdr->version != PLAN_VERSION ||
+        hdr->file_count < 0 || hdr->extent_count < 0 ||
+        plan_size != sizeof(PlanHeader) + (size_t)hdr->file_count * sizeof(PlanFile)
+                     + (size_t)hdr->extent_count * sizeof(PlanExtent)) {
+        rc = PLAN_ERR_FORMAT;
+    } else if (hdr->blocksize != (uint32_t)sb->blocksize || hdr->image_size != (uint64_t)in_size ||
+               hdr->source_checksum != source_checksum(sb, in_buf, in_size)) {
+        rc = PLAN_ERR_MISMATCH;
+    } else if (hdr->next_free < 0 || hdr->next_free > sb->swap_offset - sb->data_offset) {
+        rc = PLAN_ERR_FORMAT;
+    } else {
+        rc = expand_plan(hdr, sb, in_buf, records, placements, map, map_size, alloc);
+        if (rc == 0) {
+            *count = hdr->file_count;
+            *next_free = hdr->next_free;
+        }
+    }
+    munmap(base, plan_size);
+    return rc;
+}
@@ -0,0 +1,77 @@
+#ifndef PLAN_FILE_H
+#define PLAN_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "superblock_def.h"
+#include "file_records.h"
+#include "layout_plan.h"
+#include "block_rewrite.h"
+#include "defrag_alloc.h"
+
+/* On-disk relocation plan. Fixed-size host-endian records (the same
+	assumption the inode casts make), 8-byte aligned so a mapped file can be
+	used in place:
+		PlanHeader | PlanFile[file_count] | PlanExtent[extent_count] */
+#define PLAN_MAGIC "DFRGPLAN"
+#define PLAN_VERSION 1
+
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t blocksize;
+	uint64_t image_size;
+	uint64_t source_checksum; /* FNV-1a of superblock and inode region */
+	int32_t file_count;
+	int32_t extent_count;
+	int32_t next_free;        /* first free data block after the layout */
+	int32_t reserved;
+} PlanHeader;
+
+typedef struct {
+	int32_t inode_index;
+	int32_t start_block;
+	int32_t pointer_block_count;
+	int32_t data_block_count;
+} PlanFile;
+
+/* Run of length blocks moving old_start.. -> new_start.. */
+typedef struct {
+	int32_t old_start;
+	int32_t new_start;
+	int32_t length;
+	int32_t is_pointer;
+} PlanExtent;
+
+#define PLAN_ERR_FORMAT   -1 /* unreadable, truncated or inconsistent plan */
+#define PLAN_ERR_MISMATCH -2 /* plan was built from a different source image */
+#define PLAN_ERR_NOMEM    -3
+
+/* Write placements and the block map (as coalesced extents). 0 on success. */
+int save_plan(const char *path,
+			  const struct superblock *sb,
+			  const unsigned char *in_buf,
+			  size_t in_size,
+			  const FilePlacement *placements,
+			  int count,
+			  const BlockMapEntry *map,
+			  int map_size,
+			  int next_free);
+
+/* Map a plan, check it against the source image and expand it into the
+	structures the rewrite passes consume, allocated from alloc (NULL for the
+	C library). Caller frees records via free_file_records and placements/map
+	via defrag_mem_free. 0 or PLAN_ERR_*. */
+int load_plan(const char *path,
+			  const struct superblock *sb,
+			  const unsigned char *in_buf,
+			  size_t in_size,
+			  FileRecord **records,
+			  FilePlacement **placements,
+			  int *count,
+			  BlockMapEntry **map,
+			  int *map_size,
+			  int *next_free,
+			  const DefragAllocator *alloc);
+
+#endif /* PLAN_FILE_H */
@@ -0,0 +1,120 @@
+#!/bin/sh
+# release_check.sh <debug_bin> <release_bin> <corpus_dir>
+#   Run both builds over every corpus image (full defrag and --consolidate-free),
+#   fail unless their outputs are byte-identical, and report the speedup.
+# release_check.sh --train <instrumented_bin> <corpus_dir>
+#   Exercise the main code paths on every image to collect PGO profiles.
+# release_check.sh --check <bin> <corpus_dir>
+#   Round-trips on every image, full defrag and --consolidate-free: the
+#   --serve-view image, --apply-delta result, --apply-plan run and `-o -`
+#   stream must each match the materialized output.
+
+# Runs per image and mode; the fastest counts, so startup noise drops out
+RUNS=3
+
+# CPU milliseconds (user + sys) used by finished children so far, from the
+# POSIX times builtin; its second line is the children's "XmY.Zs XmY.Zs".
+# times must run in this shell, not in a $(...) subshell with no children.
+child_cpu_ms() {
+    awk 'NR == 2 {
+        split($1, u, /[ms]/)
+        split($2, s, /[ms]/)
+        printf "%d\n", (u[1] * 60 + u[2] + s[1] * 60 + s[2]) * 1000
+    }' "$tmp/times"
+}
+
+# best_ms <output> <bin> <args...>: fastest of RUNS runs writing <output>
+best_ms() {
+    out=$1
+    shift
+    best=
+    run=0
+    while [ $run -lt $RUNS ]; do
+        times >"$tmp/times"
+        t0=$(child_cpu_ms)
+        "$@" -o "$out" >/dev/null || exit 1
+        times >"$tmp/times"
+        t=$(($(child_cpu_ms) - t0))
+        if [ -z "$best" ] || [ $t -lt $best ]; then best=$t; fi
+        run=$((run + 1))
+    done
+    echo $best
+}
+
+tmp=$(mktemp -d) || exit 1
+trap 'rm -rf "$tmp"' EXIT
+
+if [ "$1" = "--train" ]; then
+    bin=$2
+    for img in "$3"/*; do
+        "$bin" "$img" -o "$tmp/out" >/dev/null || exit 1
+        "$bin" "$img" -o - --manifest "$tmp/m" >"$tmp/out" || exit 1
+        "$bin" "$img" --check-manifest "$tmp/m" "$tmp/out" >/dev/null || exit 1
+        "$bin" "$img" --consolidate-free --delta "$tmp/delta" >/dev/null || exit 1
+        "$bin" "$img" --emit-plan "$tmp/plan" >/dev/null || exit 1
+        "$bin" "$img" --apply-plan "$tmp/plan" -o "$tmp/out" >/dev/null || exit 1
+        echo "trained on $img"
+    done
+    exit 0
+fi
+
+# Identical to the materialized output, or report and fail
+same() {
+    cmp -s "$tmp/full" "$1" && return
+    echo "$label: $2 differs from the materialized output"
+    status=1
+    ok=0
+}
+
+if [ "$1" = "--check" ]; then
+    bin=$2
+    status=0
+    for img in "$3"/*; do
+        for mode in "" "--consolidate-free"; do
+            label="$(basename "$img") ${mode:-full}"
+            ok=1
+            "$bin" -q "$img" $mode -o "$tmp/full" || exit 1
+            # The whole view in odd-sized requests that straddle block edges
+            size=$(wc -c <"$tmp/full")
+            awk -v n="$size" 'BEGIN { for (o = 0; o < n; o += 65537) print o, 65537 }' |
+                "$bin" -q "$img" $mode --serve-view >"$tmp/view" || exit 1
+            same "$tmp/view" "--serve-view image"
+            "$bin" -q "$img" $mode --delta "$tmp/delta" || exit 1
+            cp "$img" "$tmp/patched"
+            "$bin" -q --apply-delta "$tmp/delta" "$tmp/patched" || exit 1
+            same "$tmp/patched" "--apply-delta result"
+            # The plan records the consolidated map, so it is applied without the flag
+            "$bin" -q "$img" $mode --emit-plan "$tmp/plan" || exit 1
+            "$bin" -q "$img" --apply-plan "$tmp/plan" -o "$tmp/planned" || exit 1
+            same "$tmp/planned" "--apply-plan output"
+            "$bin" -q "$img" $mode -o - >"$tmp/stream" || exit 1
+            same "$tmp/stream" "-o - stream"
+            [ $ok = 1 ] && echo "$label: round-trips ok"
+        done
+    done
+    [ $status = 0 ] && echo "check: all round-trips match" || echo "check: round-trips differ"
+    exit $status
+fi
+
+debug=$1
+release=$2
+status=0
+debug_total=0
+release_total=0
+for img in "$3"/*; do
+    for mode in "" "--consolidate-free"; do
+        debug_ms=$(best_ms "$tmp/debug" "$debug" "$img" $mode) || exit 1
+        release_ms=$(best_ms "$tmp/release" "$release" "$img" $mode) || exit 1
+        if cmp -s "$tmp/debug" "$tmp/release"; then result=identical; else result=DIFFERENT; status=1; fi
+        printf '%-40s debug %6d ms  release %6d ms  %s\n' "$(basename "$img") ${mode:-full}" \
+            "$debug_ms" "$release_ms" "$result"
+        debug_total=$((debug_total + debug_ms))
+        release_total=$((release_total + release_ms))
+    done
+done
+[ "$release_total" -gt 0 ] || release_total=1
+speedup=$((debug_total * 100 / release_total))
+printf 'total CPU (best of %d): debug %d ms, release %d ms, speedup %d.%02dx\n' \
+    "$RUNS" "$debug_total" "$release_total" $((speedup / 100)) $((speedup % 100))
+[ $status = 0 ] && echo "release-check: all outputs identical" || echo "release-check: outputs differ"
+exit $status
@@ -0,0 +1,72 @@
+#include "remap_log.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int old_index;
+    int new_index;
+} RemapPair;
+
+static int cmp_remap_old(const void *a, const void *b) {
+    int x = ((const RemapPair *)a)->old_index;
+    int y = ((const RemapPair *)b)->old_index;
+    return (x > y) - (x < y);
+}
+
+static int put_le(FILE *f, int v) {
+    unsigned char b[4];
+    write_int_le(b, v);
+    return fwrite(b, 1, 4, f) == 4 ? 0 : -1;
+}
+
+int write_remap_log(const char *path,
+                    const struct superblock *sb,
+                    const BlockMapEntry *map,
+                    int map_size,
+                    int *extent_count) {
+    if (!path || !sb || map_size < 0 || (map_size > 0 && !map)) return -1;
+    RemapPair *pairs = (RemapPair *)malloc(sizeof(RemapPair) * (size_t)(map_size > 0 ? map_size : 1));
+    if (!pairs) return -1;
+    for (int m = 0; m < map_size; ++m) {
+        pairs[m].old_index = map[m].old_index;
+        pairs[m].new_index = map[m].new_index;
+    }
+    qsort(pairs, (size_t)map_size, sizeof(RemapPair), cmp_remap_old);
+
+    /* Collapse in place: pairs[e] becomes extent e, lengths kept alongside */
+    int *lengths = (int *)malloc(sizeof(int) * (size_t)(map_size > 0 ? map_size : 1));
+    if (!lengths) { free(pairs); return -1; }
+    int n = 0;
+    for (int m = 0; m < map_size; ++m) {
+        if (n > 0 &&
+            pairs[n - 1].old_index + lengths[n - 1] == pairs[m].old_index &&
+            pairs[n - 1].new_index + lengths[n - 1] == pairs[m].new_index) {
+            lengths[n - 1]++;
+            continue;
+        }
+        pairs[n] = pairs[m];
+        lengths[n] = 1;
+        n++;
+    }
+
+    FILE *f = fopen(path, "wb");
+    int ok = f != NULL;
+    if (ok) {
+        ok = fwrite("DFRGRMAP", 1, 8, f) == 8 &&
+             put_le(f, REMAP_LOG_VERSION) == 0 &&
+             put_le(f, sb->blocksize) == 0 &&
+             put_le(f, n) == 0;
+        for (int e = 0; e < n && ok; ++e) {
+            ok = put_le(f, pairs[e].old_index) == 0 &&
+                 put_le(f, pairs[e].new_index) == 0 &&
+                 put_le(f, lengths[e]) == 0;
+        }
+        if (fclose(f) != 0) ok = 0;
+    }
+    free(lengths);
+    free(pairs);
+    if (ok && extent_count) *extent_count = n;
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,24 @@
+#ifndef REMAP_LOG_H
+#define REMAP_LOG_H
+
+#include "superblock_def.h"
+#include "block_rewrite.h"
+
+/* Remap log format (little-endian, independent of host):
+	header:  "DFRGRMAP" u32 version, u32 blocksize, u32 extent count
+	extents: u32 old_start, u32 new_start, u32 length
+	Extents cover every mapped data-region block (data and pointer blocks),
+	are sorted by old_start and never overlap. Old blocks not covered are
+	free after the defrag. */
+#define REMAP_LOG_VERSION 1
+
+/* Sort the block map by old index, run-length encode it and write it to path.
+	Stores the number of extents written in *extent_count when non-NULL.
+	Returns 0 on success. */
+int write_remap_log(const char *path,
+					const struct superblock *sb,
+					const BlockMapEntry *map,
+					int map_size,
+					int *extent_count);
+
+#endif /* REMAP_LOG_H */
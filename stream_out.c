@@ -0,0 +1,191 @@
+#define _POSIX_C_SOURCE 200809L
+#include "stream_out.h"
+#include "block_hash.h"
+#include "util.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+int stream_open(StreamWriter *w, int fd, size_t min_cap, const DefragAllocator *alloc) {
+    if (!w || fd < 0) return -1;
+    w->fd = fd;
+    w->cap = min_cap > STREAM_BUFFER_BYTES ? min_cap : STREAM_BUFFER_BYTES;
+    w->len = 0;
+    w->written = 0;
+    w->alloc = alloc;
+    w->buf = (unsigned char *)defrag_mem_alloc(alloc, w->cap);
+    return w->buf ? 0 : -1;
+}
+
+int stream_write_all(int fd, const unsigned char *p, size_t n) {
+    while (n > 0) {
+        ssize_t wr = write(fd, p, n);
+        if (wr < 0 && errno == EINTR) continue;
+        if (wr <= 0) return -1;
+        p += wr;
+        n -= (size_t)wr;
+    }
+    return 0;
+}
+
+int stream_flush(StreamWriter *w) {
+    if (w->len == 0) return 0;
+    if (stream_write_all(w->fd, w->buf, w->len) != 0) return -1;
+    w->written += (long long)w->len;
+    w->len = 0;
+    return 0;
+}
+
+unsigned char *stream_reserve(StreamWriter *w, size_t n) {
+    if (n > w->cap) return NULL;
+    if (w->cap - w->len < n && stream_flush(w) != 0) return NULL;
+    unsigned char *p = w->buf + w->len;
+    w->len += n;
+    return p;
+}
+
+int stream_put(StreamWriter *w, const unsigned char *data, size_t n) {
+    /* Large runs (inode region, swap) bypass the buffer */
+    if (n >= w->cap) {
+        if (stream_flush(w) != 0 || stream_write_all(w->fd, data, n) != 0) return -1;
+        w->written += (long long)n;
+        return 0;
+    }
+    unsigned char *p = stream_reserve(w, n);
+    if (!p) return -1;
+    memcpy(p, data, n);
+    return 0;
+}
+
+void stream_close(StreamWriter *w) {
+    defrag_mem_free(w->alloc, w->buf);
+    w->buf = NULL;
+}
+
+typedef struct {
+    int inode_index;
+    int record;
+} SlotRecord;
+
+static int cmp_slot_record(const void *a, const void *b) {
+    int x = ((const SlotRecord *)a)->inode_index;
+    int y = ((const SlotRecord *)b)->inode_index;
+    return (x > y) - (x < y);
+}
+
+/* Boot block, superblock and inode region, a window at a time: copied from
+   the input, with the free_block field and the used inodes rewritten */
+static int stream_head(RewriteContext *ctx, StreamWriter *w, size_t data_abs, int next_free) {
+    size_t inode_abs = 512 + 512 + (size_t)ctx->sb->inode_offset * (size_t)ctx->sb->blocksize;
+    size_t isz = sizeof(struct inode);
+    SlotRecord *order = (SlotRecord *)defrag_mem_alloc(ctx->alloc,
+                                                       sizeof(SlotRecord) * (size_t)(ctx->count > 0 ? ctx->count : 1));
+    if (!order) return STREAM_ERR_NOMEM;
+    for (int i = 0; i < ctx->count; ++i) {
+        order[i].inode_index = ctx->records[i].inode_index;
+        order[i].record = i;
+    }
+    qsort(order, (size_t)ctx->count, sizeof(SlotRecord), cmp_slot_record);
+
+    unsigned char free_head[4];
+    write_int_le(free_head, next_free);
+    int next = 0; /* first record (in slot order) not yet fully written */
+    for (size_t off = 0; off < data_abs; ) {
+        size_t n = data_abs - off < w->cap ? data_abs - off : w->cap;
+        unsigned char *win = stream_reserve(w, n);
+        if (!win) {
+            defrag_mem_free(ctx->alloc, order);
+            return STREAM_ERR_IO;
+        }
+        memcpy(win, ctx->in_buf + off, n);
+        overlay_range(win, off, n, free_head, 512 + 20, sizeof(free_head));
+        for (int k = next; k < ctx->count; ++k) {
+            if (order[k].inode_index < 0) continue;
+            size_t slot_abs = inode_abs + (size_t)order[k].inode_index * isz;
+            if (slot_abs >= off + n || slot_abs + isz > data_abs) break;
+            struct inode ino;
+            rewrite_inode_to(ctx, order[k].record, &ino);
+            overlay_range(win, off, n, (const unsigned char *)&ino, slot_abs, isz);
+            if (slot_abs + isz <= off + n) next = k + 1; /* an inode across the window edge is redone */
+        }
+        off += n;
+    }
+    defrag_mem_free(ctx->alloc, order);
+    return 0;
+}
+
+typedef struct {
+    int old_index;
+    int map_pos;
+    int slot; /* block position in the output window */
+} WindowSlot;
+
+static int cmp_window_old(const void *a, const void *b) {
+    int x = ((const WindowSlot *)a)->old_index;
+    int y = ((const WindowSlot *)b)->old_index;
+    return (x > y) - (x < y);
+}
+
+int stream_defragmented_image(RewriteContext *ctx, size_t in_size, int next_free, int fd) {
+    if (!ctx || !ctx->sb || !ctx->ops || !ctx->in_buf || !ctx->new_of_old) return STREAM_ERR_FORMAT;
+    const struct superblock *sb = ctx->sb;
+    size_t bs = (size_t)sb->blocksize;
+    size_t data_abs = 512 + 512 + (size_t)sb->data_offset * bs;
+    size_t swap_abs = 512 + 512 + (size_t)sb->swap_offset * bs;
+    int total = sb->swap_offset - sb->data_offset;
+    if (swap_abs > in_size || next_free < 0 || next_free > total) return STREAM_ERR_FORMAT;
+
+    int *by_new = map_by_new_index(ctx, total);
+    if (!by_new) return STREAM_ERR_FORMAT;
+    StreamWriter w;
+    WindowSlot *slots = NULL;
+    int rc = STREAM_ERR_NOMEM;
+    if (stream_open(&w, fd, bs, ctx->alloc) != 0) goto out;
+    slots = (WindowSlot *)defrag_mem_alloc(ctx->alloc, sizeof(WindowSlot) * (w.cap / bs));
+    if (!slots) goto close;
+
+    rc = stream_head(ctx, &w, data_abs, next_free);
+
+    /* Data region in new order, then the ascending free chain: each window's
+       blocks are read in ascending source order, as rewrite_data_blocks does */
+    for (int idx = 0; idx < total && rc == 0; ) {
+        int room = (int)((w.cap - w.len) / bs);
+        if (room == 0) room = (int)(w.cap / bs);
+        int nblk = total - idx < room ? total - idx : room;
+        unsigned char *win = stream_reserve(&w, (size_t)nblk * bs);
+        if (!win) { rc = STREAM_ERR_IO; break; }
+        int pending = 0;
+        for (int k = 0; k < nblk; ++k) {
+            int at = idx + k;
+            unsigned char *dst = win + (size_t)k * bs;
+            if (at >= next_free) {
+                ctx->ops->fill_free_block(dst, at + 1 < total ? at + 1 : -1, bs);
+            } else if (by_new[at] >= 0) {
+                slots[pending].old_index = ctx->map[by_new[at]].old_index;
+                slots[pending].map_pos = by_new[at];
+                slots[pending++].slot = k;
+            } else {
+                memset(dst, 0, bs);
+            }
+        }
+        qsort(slots, (size_t)pending, sizeof(WindowSlot), cmp_window_old);
+        for (int k = 0; k < pending; ++k) {
+            unsigned char *dst = win + (size_t)slots[k].slot * bs;
+            rewrite_block_to(ctx, slots[k].map_pos, dst);
+            if (ctx->hashes && ctx->map[slots[k].map_pos].is_pointer != 1) {
+                ctx->hashes[slots[k].map_pos] = block_hash(dst, bs);
+            }
+        }
+        idx += nblk;
+    }
+
+    if (rc == 0 && stream_put(&w, ctx->in_buf + swap_abs, in_size - swap_abs) != 0) rc = STREAM_ERR_IO;
+    if (rc == 0 && stream_flush(&w) != 0) rc = STREAM_ERR_IO;
+    defrag_mem_free(ctx->alloc, slots);
+close:
+    stream_close(&w);
+out:
+    defrag_mem_free(ctx->alloc, by_new);
+    return rc;
+}
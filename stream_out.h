@@ -0,0 +1,45 @@
+#ifndef STREAM_OUT_H
+#define STREAM_OUT_H
+
+#include <stddef.h>
+#include "block_rewrite.h"
+#include "defrag_alloc.h"
+
+/* Output is staged in a buffer of this many bytes (or one block, if larger)
+	and written once it fills, so memory does not grow with the image. */
+#define STREAM_BUFFER_BYTES (1 << 20)
+
+/* Error codes from stream_defragmented_image */
+#define STREAM_ERR_IO      -1
+#define STREAM_ERR_NOMEM   -2
+#define STREAM_ERR_FORMAT  -3
+
+typedef struct {
+	int fd;
+	unsigned char *buf;
+	size_t cap;
+	size_t len;
+	long long written; /* bytes handed to write() so far */
+	const DefragAllocator *alloc;
+} StreamWriter;
+
+/* Write all n bytes to fd, retrying short writes and EINTR; 0 or -1 */
+int stream_write_all(int fd, const unsigned char *p, size_t n);
+
+int stream_open(StreamWriter *w, int fd, size_t min_cap, const DefragAllocator *alloc);
+/* Space for n <= cap bytes at the end of the buffer, flushing first if
+	needed; NULL on write error. The caller fills all n bytes. */
+unsigned char *stream_reserve(StreamWriter *w, size_t n);
+int stream_put(StreamWriter *w, const unsigned char *data, size_t n);
+int stream_flush(StreamWriter *w);
+void stream_close(StreamWriter *w);
+
+/* Emit the defragmented image strictly in file order to fd: boot block,
+	superblock, inode region, data region in new block order, free blocks,
+	swap. Everything goes out one buffer window at a time (inodes are
+	remapped per window, and each data window reads its sources in
+	ascending old index); ctx must have a block map and its remap table
+	(build_remap_table). Returns 0 or a STREAM_ERR_* code. */
+int stream_defragmented_image(RewriteContext *ctx, size_t in_size, int next_free, int fd);
+
+#endif /* STREAM_OUT_H */
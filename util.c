@@ -2,15 +2,21 @@
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-int safe_read_int_le(const unsigned char *p) {
-    /* Little-endian 4-byte integer */
-    return (int)(
-        ((unsigned int)p[0]) |
-        ((unsigned int)p[1] << 8) |
-        ((unsigned int)p[2] << 16) |
-        ((unsigned int)p[3] << 24)
-    );
+uint64_t fnv1a64(const unsigned char *p, size_t n) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < n; ++i) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+void overlay_range(unsigned char *buf, size_t off, size_t len, const unsigned char *src, size_t src_off, size_t n) {
+    size_t lo = off > src_off ? off : src_off;
+    size_t hi = off + len < src_off + n ? off + len : src_off + n;
+    if (lo < hi) memcpy(buf + (lo - off), src + (lo - src_off), hi - lo);
 }
 
 void fatal(const char *fmt, ...) {
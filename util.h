@@ -1,7 +1,30 @@
 #ifndef UTIL_H
 #define UTIL_H
 
-int safe_read_int_le(const unsigned char *p);
+#include <stddef.h>
+#include <stdint.h>
+
+/* Little-endian 4-byte integers; inline because the block kernels call
+   them for every pointer entry */
+static inline int safe_read_int_le(const unsigned char *p) {
+    return (int)(
+        ((unsigned int)p[0]) |
+        ((unsigned int)p[1] << 8) |
+        ((unsigned int)p[2] << 16) |
+        ((unsigned int)p[3] << 24)
+    );
+}
+
+static inline void write_int_le(unsigned char *p, int v) {
+    p[0] = (unsigned char)(v & 0xFF);
+    p[1] = (unsigned char)((v >> 8) & 0xFF);
+    p[2] = (unsigned char)((v >> 16) & 0xFF);
+    p[3] = (unsigned char)((v >> 24) & 0xFF);
+}
+uint64_t fnv1a64(const unsigned char *p, size_t n);
+/* Copy the part of src (covering [src_off, src_off + n)) that falls inside
+   buf (covering [off, off + len)); the image readers patch fields this way */
+void overlay_range(unsigned char *buf, size_t off, size_t len, const unsigned char *src, size_t src_off, size_t n);
 void fatal(const char *fmt, ...);
 
 #endif /* UTIL_H */
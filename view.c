@@ -0,0 +1,137 @@
+#include "view.h"
+#include "inode_scan.h"
+#include "util.h"
+#include <string.h>
+
+static int *alloc_unset(const DefragAllocator *alloc, int n) {
+    int *a = (int *)defrag_mem_alloc(alloc, sizeof(int) * (size_t)(n > 0 ? n : 1));
+    if (a) {
+        for (int i = 0; i < n; ++i) a[i] = -1;
+    }
+    return a;
+}
+
+int view_open(DefragView *v, const RewriteContext *rw, size_t size, int next_free,
+              const DefragAllocator *alloc) {
+    if (!v || !rw || !rw->sb || !rw->ops || !rw->in_buf || !rw->new_of_old) return -1;
+    memset(v, 0, sizeof(*v));
+    const struct superblock *sb = rw->sb;
+    size_t bs = (size_t)sb->blocksize;
+    size_t swap_abs = 512 + 512 + (size_t)sb->swap_offset * bs;
+    v->rw = rw;
+    v->size = size;
+    v->next_free = next_free;
+    v->total_blocks = sb->swap_offset - sb->data_offset;
+    v->inode_slots = (int)((size_t)(sb->data_offset - sb->inode_offset) * bs / sizeof(struct inode));
+    v->alloc = alloc;
+    if (swap_abs > size || next_free < 0 || next_free > v->total_blocks) return -1;
+
+    v->map_of_new = map_by_new_index(rw, v->total_blocks);
+    v->record_of_slot = alloc_unset(alloc, v->inode_slots);
+    if (!v->record_of_slot) {
+        view_close(v);
+        return -2;
+    }
+    if (!v->map_of_new) {
+        view_close(v);
+        return -1; /* duplicate or out-of-range new index (or no memory for it) */
+    }
+    for (int i = 0; i < rw->count; ++i) {
+        int slot = rw->records[i].inode_index;
+        if (slot >= 0 && slot < v->inode_slots) v->record_of_slot[slot] = i;
+    }
+    return 0;
+}
+
+void view_close(DefragView *v) {
+    if (!v) return;
+    defrag_mem_free(v->alloc, v->map_of_new);
+    defrag_mem_free(v->alloc, v->record_of_slot);
+    v->map_of_new = NULL;
+    v->record_of_slot = NULL;
+}
+
+/* Bytes [off, off + len) of the region before the data blocks */
+static void read_head(const DefragView *v, size_t off, unsigned char *buf, size_t len) {
+    const RewriteContext *rw = v->rw;
+    memcpy(buf, rw->in_buf + off, len);
+
+    /* Superblock free_block points at the new free chain */
+    unsigned char head[4];
+    write_int_le(head, v->next_free);
+    overlay_range(buf, off, len, head, 512 + 20, sizeof(head));
+
+    /* Used inodes in the requested range get remapped pointers */
+    size_t inode_abs = 512 + 512 + (size_t)rw->sb->inode_offset * (size_t)rw->sb->blocksize;
+    size_t isz = sizeof(struct inode);
+    if (off + len <= inode_abs || v->inode_slots == 0) return;
+    size_t first = off > inode_abs ? (off - inode_abs) / isz : 0;
+    size_t last = (off + len - inode_abs + isz - 1) / isz;
+    if (last > (size_t)v->inode_slots) last = (size_t)v->inode_slots;
+    for (size_t slot = first; slot < last; ++slot) {
+        int r = v->record_of_slot[slot];
+        if (r < 0) continue;
+        struct inode ino;
+        rewrite_inode_to(rw, r, &ino);
+        overlay_range(buf, off, len, (const unsigned char *)&ino, inode_abs + slot * isz, isz);
+    }
+}
+
+/* New contents of data block idx */
+static void read_block(const DefragView *v, int idx, unsigned char *dst) {
+    const RewriteContext *rw = v->rw;
+    size_t bs = (size_t)rw->sb->blocksize;
+    if (idx >= v->next_free) {
+        rw->ops->fill_free_block(dst, idx + 1 < v->total_blocks ? idx + 1 : -1, bs);
+        return;
+    }
+    int m = v->map_of_new[idx];
+    if (m < 0) {
+        memset(dst, 0, bs);
+        return;
+    }
+    rewrite_block_to(rw, m, dst);
+}
+
+int view_read(const DefragView *v, size_t offset, unsigned char *buf, size_t len, size_t *got) {
+    if (!v || !v->map_of_new || (!buf && len > 0) || !got) return -1;
+    const struct superblock *sb = v->rw->sb;
+    size_t bs = (size_t)sb->blocksize;
+    size_t data_abs = 512 + 512 + (size_t)sb->data_offset * bs;
+    size_t swap_abs = 512 + 512 + (size_t)sb->swap_offset * bs;
+    *got = 0;
+    if (offset >= v->size) return 0;
+    if (len > v->size - offset) len = v->size - offset;
+
+    unsigned char *scratch = NULL;
+    size_t pos = offset, end = offset + len;
+    while (pos < end) {
+        unsigned char *dst = buf + (pos - offset);
+        if (pos < data_abs) {
+            size_t n = (end < data_abs ? end : data_abs) - pos;
+            read_head(v, pos, dst, n);
+            pos += n;
+        } else if (pos < swap_abs) {
+            int idx = (int)((pos - data_abs) / bs);
+            size_t in_block = (pos - data_abs) % bs;
+            size_t n = bs - in_block;
+            if (n > end - pos) n = end - pos;
+            if (n == bs) {
+                read_block(v, idx, dst);
+            } else {
+                /* Partial block: synthesize the whole block aside */
+                if (!scratch) scratch = (unsigned char *)defrag_mem_alloc(v->alloc, bs);
+                if (!scratch) return -1;
+                read_block(v, idx, scratch);
+                memcpy(dst, scratch + in_block, n);
+            }
+            pos += n;
+        } else {
+            memcpy(dst, v->rw->in_buf + pos, end - pos);
+            pos = end;
+        }
+    }
+    defrag_mem_free(v->alloc, scratch);
+    *got = len;
+    return 0;
+}
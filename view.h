@@ -0,0 +1,32 @@
+#ifndef VIEW_H
+#define VIEW_H
+
+#include <stddef.h>
+#include "block_rewrite.h"
+#include "defrag_alloc.h"
+
+/* Read-only defragmented image synthesized on demand from the input and
+	its block map: inodes, pointer blocks, the free chain and the superblock
+	head are produced per read, data blocks are read through the remap. On
+	top of the context's remap table the view costs one int per data block
+	and per inode slot, never a full copy. */
+typedef struct {
+	const RewriteContext *rw; /* sb, ops, in_buf, records, map and new_of_old; must outlive the view */
+	size_t size;              /* image size (same as the input) */
+	int next_free;
+	int total_blocks;         /* data region size in blocks */
+	int inode_slots;
+	int *map_of_new;          /* map entry for each new data block, -1 if none */
+	int *record_of_slot;      /* record for each inode slot, -1 if unused */
+	const DefragAllocator *alloc;
+} DefragView;
+
+int view_open(DefragView *v, const RewriteContext *rw, size_t size, int next_free,
+			  const DefragAllocator *alloc); /* 0; -1 for a bad map, -2 when out of memory */
+/* Copy up to len bytes of the view at offset into buf; *got is short only
+	past the end of the image. Does not modify the view, so concurrent
+	readers are fine. Returns 0, or -1 on allocation failure. */
+int view_read(const DefragView *v, size_t offset, unsigned char *buf, size_t len, size_t *got);
+void view_close(DefragView *v);
+
+#endif /* VIEW_H */